@@ -1,24 +1,88 @@
 #pragma once
 
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <type_traits>
+
 class ArenaAllocator
 {
 private:
     size_t m_Size;
+    // a full block is kept and a new one chained after it, so a program is only limited by the heap
+    std::vector<std::pair<std::byte *, size_t>> m_Blocks;
     std::byte *m_Buffer;
     std::byte *m_Offset;
+    // nodes that own memory of their own (the vectors in a scope, a call...) are destroyed when they are released
+    std::vector<std::pair<void *, void (*)(void *)>> m_Destructors;
+
+    void grow(const size_t bytes)
+    {
+        const size_t size = std::max(m_Size, bytes);
+        m_Buffer = static_cast<std::byte *>(malloc(size));
+        if (!m_Buffer)
+        {
+            std::cerr << "Error : Out of memory" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_Blocks.emplace_back(m_Buffer, size);
+        m_Offset = m_Buffer;
+    }
+
+    void destroy(const size_t count)
+    {
+        while (m_Destructors.size() > count)
+        {
+            m_Destructors.back().second(m_Destructors.back().first);
+            m_Destructors.pop_back();
+        }
+    }
 
 public:
+    // everything allocated after a mark is released by rewinding to it
+    struct Mark
+    {
+        size_t blocks;
+        std::byte *offset;
+        size_t destructors;
+    };
+
     inline explicit ArenaAllocator(size_t bytes) : m_Size(bytes)
     {
-        m_Buffer = static_cast<std::byte *>(malloc(m_Size));
-        m_Offset = m_Buffer;
+        grow(m_Size);
     }
 
     template<typename T>
     inline T* allocate(){
-        void* offset = m_Offset;
-        m_Offset += sizeof(T);
-        return static_cast<T*>(offset);
+        size_t padding = (alignof(T) - reinterpret_cast<uintptr_t>(m_Offset) % alignof(T)) % alignof(T);
+        if (m_Offset + padding + sizeof(T) > m_Buffer + m_Blocks.back().second)
+        {
+            grow(sizeof(T) + alignof(T));
+            padding = (alignof(T) - reinterpret_cast<uintptr_t>(m_Offset) % alignof(T)) % alignof(T);
+        }
+        T *object = new (m_Offset + padding) T();
+        m_Offset += padding + sizeof(T);
+        if constexpr (!std::is_trivially_destructible_v<T>)
+            m_Destructors.emplace_back(object, [](void *ptr)
+                                       { static_cast<T *>(ptr)->~T(); });
+        return object;
+    }
+
+    inline Mark mark() const
+    {
+        return {.blocks = m_Blocks.size(), .offset = m_Offset, .destructors = m_Destructors.size()};
+    }
+
+    inline void rewind(const Mark &mark)
+    {
+        destroy(mark.destructors);
+        while (m_Blocks.size() > mark.blocks)
+        {
+            free(m_Blocks.back().first);
+            m_Blocks.pop_back();
+        }
+        m_Buffer = m_Blocks.back().first;
+        m_Offset = mark.offset;
     }
 
     inline ArenaAllocator(const ArenaAllocator &arena) = delete;
@@ -28,6 +92,8 @@ public:
 
     inline ~ArenaAllocator()
     {
-        free(m_Buffer);
+        destroy(0);
+        for (const auto &[block, size] : m_Blocks)
+            free(block);
     }
 };
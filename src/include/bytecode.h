@@ -0,0 +1,535 @@
+#pragma once
+
+#include "./node.h"
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <variant>
+#include <vector>
+
+// a register machine: every function gets a window of registers, its parameters first, then its
+// variables and temporaries, allocated like a stack. an array takes one register per element
+namespace bytecode
+{
+    // the order is the one of the interpreter's dispatch table
+    enum class Op : uint32_t
+    {
+        loadk,  // a = constants[b]
+        mov,    // a = b
+        add,    // a = b + c, same for the other arithmetic and comparisons, all unsigned
+        sub,
+        mul,
+        div,    // traps like the DIV of the native code when c is 0
+        eq,
+        ne,
+        lt,
+        le,
+        gt,
+        ge,
+        notOp,  // a = !b
+        boolOp, // a = b != 0
+        jmp,    // to a
+        jz,     // to b when a is 0
+        jnz,    // to b when a isn't 0
+        check,  // traps when a >= b (the length of an array)
+        loade,  // a = b[c], b is the first register of an array
+        storee, // a[b] = c
+        zero,   // b registers from a on are set to 0
+        call,   // a = functions[b](the registers from c on), the callee's window starts at c
+        ret,    // returns a
+        exit,   // exits with a
+        count,
+    };
+
+    // fixed width, the operands are registers, instruction indices or immediates depending on the op
+    struct Instruction
+    {
+        Op op;
+        uint32_t a{}, b{}, c{};
+    };
+
+    struct Function
+    {
+        size_t entry;
+        size_t frameSize; // registers
+    };
+
+    struct Program
+    {
+        std::vector<Instruction> code; // the top level statements start at 0
+        std::vector<uint64_t> constants;
+        std::vector<Function> functions;
+        size_t frameSize; // registers of the top level
+    };
+}
+
+// compiles a program the code generator has already checked into bytecode for the interpreter
+class BytecodeCompiler
+{
+private:
+    using Op = bytecode::Op;
+
+    const node::Prog &m_Prog;
+    bytecode::Program m_Program{};
+    std::map<std::string, uint32_t> m_FunctionIndices{};
+    std::map<uint64_t, uint32_t> m_ConstantIndices{};
+
+    struct Variable
+    {
+        std::string name;
+        uint32_t reg;
+        uint32_t length; // element count of an array, 0 for a scalar
+    };
+
+    std::vector<Variable> m_Variables{};
+    std::vector<std::pair<size_t, uint32_t>> m_Scopes{}; // the variable count and the first free register when the scope began
+    uint32_t m_Top = 0;                                  // first free register
+    uint32_t m_FrameSize = 0;                            // registers the current function needs
+    size_t m_Label = 0;                                  // latest jump target, the instruction in front of it can't be rewritten
+    std::optional<uint32_t> m_Element{};                 // the element counter of the element-wise loop being compiled
+
+    uint32_t alloc(const uint32_t count = 1)
+    {
+        const uint32_t reg = m_Top;
+        m_Top += count;
+        m_FrameSize = std::max(m_FrameSize, m_Top);
+        return reg;
+    }
+
+    size_t emit(const Op op, const uint32_t a = 0, const uint32_t b = 0, const uint32_t c = 0)
+    {
+        m_Program.code.push_back({.op = op, .a = a, .b = b, .c = c});
+        return m_Program.code.size() - 1;
+    }
+
+    // the position of the next instruction, as a jump target
+    uint32_t here()
+    {
+        m_Label = m_Program.code.size();
+        return m_Label;
+    }
+
+    uint32_t constant(const uint64_t value)
+    {
+        const auto [itr, inserted] = m_ConstantIndices.emplace(value, m_Program.constants.size());
+        if (inserted)
+            m_Program.constants.push_back(value);
+        return itr->second;
+    }
+
+    const Variable &variable(const Token &ident) const
+    {
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                              { return var.name == ident.value.value(); });
+        if (itr == m_Variables.end())
+        {
+            std::cerr << "Error : Undeclared Identifier : " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return *itr;
+    }
+
+    static bool writesA(const Op op)
+    {
+        return op != Op::jmp && op != Op::jz && op != Op::jnz && op != Op::check && op != Op::storee &&
+               op != Op::zero && op != Op::ret && op != Op::exit;
+    }
+
+    // dst = src, the temporary src at or above mark is computed straight into dst when it was the last write
+    void move(const uint32_t dst, const uint32_t src, const uint32_t mark)
+    {
+        if (dst == src)
+            return;
+        bytecode::Instruction &last = m_Program.code.back();
+        if (src >= mark && m_Label != m_Program.code.size() && writesA(last.op) && last.a == src)
+        {
+            last.a = dst;
+            return;
+        }
+        emit(Op::mov, dst, src);
+    }
+
+    using ExprNode = std::variant<const node::Term *, const node::Exprs *>;
+
+    static ExprNode asNode(const node::Expr *expr)
+    {
+        return std::visit([](const auto *node) -> ExprNode
+                          { return node; },
+                          expr->variant);
+    }
+
+    static Op binaryOp(const node::Exprs *exprs)
+    {
+        return std::visit([](const auto *opr)
+                          {
+            using T = std::remove_cvref_t<decltype(*opr)>;
+            if constexpr (std::is_same_v<T, node::ExprsAdd>) return Op::add;
+            else if constexpr (std::is_same_v<T, node::ExprsSub>) return Op::sub;
+            else if constexpr (std::is_same_v<T, node::ExprsMul>) return Op::mul;
+            else if constexpr (std::is_same_v<T, node::ExprsDiv>) return Op::div;
+            else if constexpr (std::is_same_v<T, node::ExprsEq>) return Op::eq;
+            else if constexpr (std::is_same_v<T, node::ExprsNotEq>) return Op::ne;
+            else if constexpr (std::is_same_v<T, node::ExprsLess>) return Op::lt;
+            else if constexpr (std::is_same_v<T, node::ExprsLessEq>) return Op::le;
+            else if constexpr (std::is_same_v<T, node::ExprsGreater>) return Op::gt;
+            else if constexpr (std::is_same_v<T, node::ExprsGreaterEq>) return Op::ge;
+            else return Op::boolOp; },
+                          exprs->variant);
+    }
+
+    // returns the register that holds the value: a variable is used in place, everything else is computed
+    // into the temporary at the first free register. like the native code, the right operand of a binary
+    // operator goes first and the arguments of a call left to right. no recursion, see CodeGenerator::runTasks
+    uint32_t compileExpr(const node::Expr *expr)
+    {
+        enum class Stage
+        {
+            schedule,
+            finish,
+            shortCircuit, // the left operand of && or || is done
+            argument,     // an argument is done, it has to be in the window of the callee
+        };
+        struct Task
+        {
+            ExprNode node;
+            Stage stage;
+            uint32_t mark{};  // first free register when the node was scheduled, its result goes there
+            size_t extra{};   // the argument number, or the jump that skips the right operand
+        };
+        std::vector<Task> tasks{{.node = asNode(expr), .stage = Stage::schedule}};
+        std::vector<uint32_t> values;
+        const auto result = [&](const uint32_t mark)
+        {
+            m_Top = mark;
+            return alloc();
+        };
+
+        while (!tasks.empty())
+        {
+            const Task task = tasks.back();
+            tasks.pop_back();
+
+            if (const auto exprs = std::get_if<const node::Exprs *>(&task.node))
+            {
+                const bool isAnd = std::holds_alternative<node::ExprsAnd *>((*exprs)->variant);
+                const bool isOr = std::holds_alternative<node::ExprsOr *>((*exprs)->variant);
+                const auto [lhs, rhs] = std::visit([](const auto *opr)
+                                                   { return std::pair{opr->lhs, opr->rhs}; },
+                                                   (*exprs)->variant);
+                if (task.stage == Stage::schedule)
+                {
+                    if (isAnd || isOr)
+                    {
+                        tasks.push_back({.node = task.node, .stage = Stage::shortCircuit, .mark = m_Top});
+                        tasks.push_back({.node = asNode(lhs), .stage = Stage::schedule});
+                        continue;
+                    }
+                    tasks.push_back({.node = task.node, .stage = Stage::finish, .mark = m_Top});
+                    tasks.push_back({.node = asNode(lhs), .stage = Stage::schedule});
+                    tasks.push_back({.node = asNode(rhs), .stage = Stage::schedule});
+                    continue;
+                }
+                if (task.stage == Stage::shortCircuit)
+                {
+                    const uint32_t value = values.back();
+                    values.pop_back();
+                    const uint32_t dst = result(task.mark);
+                    emit(Op::boolOp, dst, value);
+                    const size_t jump = emit(isAnd ? Op::jz : Op::jnz, dst);
+                    tasks.push_back({.node = task.node, .stage = Stage::finish, .mark = task.mark, .extra = jump});
+                    tasks.push_back({.node = asNode(rhs), .stage = Stage::schedule});
+                    continue;
+                }
+                if (isAnd || isOr)
+                {
+                    emit(Op::boolOp, task.mark, values.back());
+                    m_Program.code[task.extra].b = here();
+                    values.back() = result(task.mark);
+                    continue;
+                }
+                const uint32_t l = values.back();
+                values.pop_back();
+                const uint32_t r = values.back();
+                values.pop_back();
+                const uint32_t dst = result(task.mark);
+                emit(binaryOp(*exprs), dst, l, r);
+                values.push_back(dst);
+                continue;
+            }
+
+            const node::Term *term = std::get<const node::Term *>(task.node);
+            if (const auto termIntLit = std::get_if<node::TermIntLit *>(&term->variant))
+            {
+                const uint32_t dst = alloc();
+                emit(Op::loadk, dst, constant(std::stoull((*termIntLit)->int_literal.value.value())));
+                values.push_back(dst);
+            }
+            else if (const auto termIdent = std::get_if<node::TermIdent *>(&term->variant))
+            {
+                const Variable &var = variable((*termIdent)->ident);
+                if (var.length && m_Element.has_value())
+                {
+                    const uint32_t dst = alloc();
+                    emit(Op::loade, dst, var.reg, m_Element.value());
+                    values.push_back(dst);
+                }
+                else
+                    values.push_back(var.reg);
+            }
+            else if (const auto termParenthesis = std::get_if<node::TermParenthesis *>(&term->variant))
+                tasks.push_back({.node = asNode((*termParenthesis)->expr), .stage = Stage::schedule});
+            else if (const auto termNot = std::get_if<node::TermNot *>(&term->variant))
+            {
+                if (task.stage == Stage::schedule)
+                {
+                    tasks.push_back({.node = task.node, .stage = Stage::finish, .mark = m_Top});
+                    tasks.push_back({.node = (*termNot)->term, .stage = Stage::schedule});
+                    continue;
+                }
+                const uint32_t value = values.back();
+                values.back() = result(task.mark);
+                emit(Op::notOp, values.back(), value);
+            }
+            else if (const auto termIndex = std::get_if<node::TermIndex *>(&term->variant))
+            {
+                if (task.stage == Stage::schedule)
+                {
+                    tasks.push_back({.node = task.node, .stage = Stage::finish, .mark = m_Top});
+                    tasks.push_back({.node = asNode((*termIndex)->index), .stage = Stage::schedule});
+                    continue;
+                }
+                const Variable &var = variable((*termIndex)->ident);
+                const uint32_t index = values.back();
+                values.back() = result(task.mark);
+                emit(Op::check, index, var.length);
+                emit(Op::loade, values.back(), var.reg, index);
+            }
+            else if (const auto termCall = std::get_if<node::TermCall *>(&term->variant))
+            {
+                const std::vector<node::Expr *> &args = (*termCall)->args;
+                if (task.stage == Stage::schedule)
+                {
+                    tasks.push_back({.node = task.node, .stage = Stage::finish, .mark = m_Top});
+                    for (size_t i = args.size(); i > 0; i--)
+                    {
+                        tasks.push_back({.node = task.node, .stage = Stage::argument, .mark = m_Top, .extra = i - 1});
+                        tasks.push_back({.node = asNode(args[i - 1]), .stage = Stage::schedule});
+                    }
+                    continue;
+                }
+                if (task.stage == Stage::argument)
+                {
+                    const uint32_t value = values.back();
+                    values.pop_back();
+                    const uint32_t slot = result(task.mark + task.extra);
+                    move(slot, value, slot);
+                    continue;
+                }
+                const uint32_t dst = result(task.mark);
+                emit(Op::call, dst, m_FunctionIndices.at((*termCall)->ident.value.value()), task.mark);
+                values.push_back(dst);
+            }
+        }
+        return values.back();
+    }
+
+    // target = expr for every element, an array in the expression stands for the element of the loop counter
+    void compileElementwise(const Variable &target, const node::Expr *expr)
+    {
+        const uint32_t mark = m_Top;
+        const uint32_t index = alloc(), length = alloc(), one = alloc(), more = alloc();
+        emit(Op::loadk, index, constant(0));
+        emit(Op::loadk, length, constant(target.length));
+        emit(Op::loadk, one, constant(1));
+        const uint32_t loop = here();
+        m_Element = index;
+        const uint32_t value = compileExpr(expr);
+        m_Element.reset();
+        emit(Op::storee, target.reg, index, value);
+        emit(Op::add, index, index, one);
+        emit(Op::lt, more, index, length);
+        emit(Op::jnz, more, loop);
+        m_Top = mark;
+    }
+
+    void beginScope()
+    {
+        m_Scopes.emplace_back(m_Variables.size(), m_Top);
+    }
+
+    void endScope()
+    {
+        m_Variables.resize(m_Scopes.back().first);
+        m_Top = m_Scopes.back().second;
+        m_Scopes.pop_back();
+    }
+
+    void compileScope(const std::vector<node::Statement *> &statements)
+    {
+        beginScope();
+        for (const node::Statement *statement : statements)
+            compileStatement(statement);
+        endScope();
+    }
+
+    void compileLet(const node::StatementLet *statementLet)
+    {
+        const uint32_t mark = m_Top;
+        const uint32_t value = compileExpr(statementLet->expr);
+        m_Top = mark;
+        const uint32_t reg = alloc();
+        move(reg, value, mark);
+        m_Variables.push_back({.name = statementLet->ident.value.value(), .reg = reg, .length = 0});
+    }
+
+    void compileAssignment(const node::StatementAssignment *statementAssign)
+    {
+        const Variable var = variable(statementAssign->ident);
+        const uint32_t mark = m_Top;
+        if (statementAssign->index)
+        {
+            const uint32_t value = compileExpr(statementAssign->expr);
+            const uint32_t index = compileExpr(statementAssign->index);
+            emit(Op::check, index, var.length);
+            emit(Op::storee, var.reg, index, value);
+        }
+        else if (var.length)
+            compileElementwise(var, statementAssign->expr);
+        else
+            move(var.reg, compileExpr(statementAssign->expr), mark);
+        m_Top = mark;
+    }
+
+    // the test sits at the bottom of the loop, like in the native code
+    void compileLoop(const node::Expr *expr, const node::Scope *scope, const node::StatementAssignment *step)
+    {
+        const size_t jump = emit(Op::jmp);
+        const uint32_t body = here();
+        compileScope(scope->statements);
+        if (step)
+            compileAssignment(step);
+        m_Program.code[jump].a = here();
+        const uint32_t mark = m_Top;
+        emit(Op::jnz, compileExpr(expr), body);
+        m_Top = mark;
+    }
+
+    // jumps to the returned instruction when the condition is 0
+    size_t compileCondition(const node::Expr *expr)
+    {
+        const uint32_t mark = m_Top;
+        const size_t jump = emit(Op::jz, compileExpr(expr));
+        m_Top = mark;
+        return jump;
+    }
+
+    void compileIf(const node::StatementIf *statementIf)
+    {
+        std::vector<size_t> ends;
+        std::optional<size_t> next = compileCondition(statementIf->expr);
+        compileScope(statementIf->scope->statements);
+        std::optional<node::ConditionalBranch *> conditionalBr = statementIf->conditionalBr;
+        while (conditionalBr.has_value())
+        {
+            ends.push_back(emit(Op::jmp));
+            m_Program.code[next.value()].b = here();
+            if (const auto conditionalBrElse = std::get_if<node::ConditionalBranchElse *>(&conditionalBr.value()->variant))
+            {
+                compileScope((*conditionalBrElse)->scope->statements);
+                next.reset();
+                break;
+            }
+            const node::ConditionalBranchElif *conditionalBrElif = std::get<node::ConditionalBranchElif *>(conditionalBr.value()->variant);
+            next = compileCondition(conditionalBrElif->expr);
+            compileScope(conditionalBrElif->scope->statements);
+            conditionalBr = conditionalBrElif->conditionalBr;
+        }
+        const uint32_t end = here();
+        if (next.has_value())
+            m_Program.code[next.value()].b = end;
+        for (const size_t jump : ends)
+            m_Program.code[jump].a = end;
+    }
+
+    void compileStatement(const node::Statement *statement)
+    {
+        const uint32_t mark = m_Top;
+        if (const auto statementExit = std::get_if<node::StatementExit *>(&statement->variant))
+            emit(Op::exit, compileExpr((*statementExit)->expr));
+        else if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+            return compileLet(*statementLet);
+        else if (const auto statementArray = std::get_if<node::StatementArray *>(&statement->variant))
+        {
+            const uint32_t length = std::stoul((*statementArray)->size.value.value());
+            const Variable var{.name = (*statementArray)->ident.value.value(), .reg = alloc(length), .length = length};
+            // the array isn't visible to its own initializer
+            if ((*statementArray)->expr)
+                compileElementwise(var, (*statementArray)->expr);
+            else
+                emit(Op::zero, var.reg, length);
+            m_Variables.push_back(var);
+            return;
+        }
+        else if (const auto assign = std::get_if<node::StatementAssignment *>(&statement->variant))
+            compileAssignment(*assign);
+        else if (const auto scope = std::get_if<node::Scope *>(&statement->variant))
+            compileScope((*scope)->statements);
+        else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            compileIf(*statementIf);
+        else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+            compileLoop((*statementWhile)->expr, (*statementWhile)->scope, nullptr);
+        else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+        {
+            beginScope();
+            compileLet((*statementFor)->init);
+            compileLoop((*statementFor)->expr, (*statementFor)->scope, (*statementFor)->step);
+            endScope();
+        }
+        else if (const auto statementReturn = std::get_if<node::StatementReturn *>(&statement->variant))
+            emit(Op::ret, compileExpr((*statementReturn)->expr));
+        else if (const auto statementCall = std::get_if<node::StatementCall *>(&statement->variant))
+        {
+            // a call statement is an expression whose result is dropped
+            node::Term term{.variant = (*statementCall)->call};
+            node::Expr expr{.variant = &term};
+            compileExpr(&expr);
+        }
+        m_Top = mark;
+    }
+
+    // falling off the end returns 0, or exits with it at the top level
+    void compileEnd(const Op op)
+    {
+        const uint32_t zero = alloc();
+        emit(Op::loadk, zero, constant(0));
+        emit(op, zero);
+    }
+
+public:
+    inline explicit BytecodeCompiler(const node::Prog &prog) : m_Prog(prog) {}
+
+    bytecode::Program compile()
+    {
+        for (const node::Function *function : m_Prog.functions)
+            m_FunctionIndices.emplace(function->ident.value.value(), m_FunctionIndices.size());
+
+        compileScope(m_Prog.statements);
+        compileEnd(Op::exit);
+        m_Program.frameSize = m_FrameSize;
+
+        for (const node::Function *function : m_Prog.functions)
+        {
+            m_Variables.clear();
+            m_Top = 0;
+            m_FrameSize = 0;
+            const size_t entry = here();
+            for (const Token &param : function->params)
+                m_Variables.push_back({.name = param.value.value(), .reg = alloc(), .length = 0});
+            compileScope(function->scope->statements);
+            compileEnd(Op::ret);
+            m_Program.functions.push_back({.entry = entry, .frameSize = m_FrameSize});
+        }
+        return m_Program;
+    }
+};
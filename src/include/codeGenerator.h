@@ -1,25 +1,119 @@
 #pragma once
 #include "./parser.h"
+#include "./peephole.h"
+#include "./liveness.h"
 #include <map>
+#include <set>
 #include <algorithm>
+#include <bit>
+#include <deque>
+#include <functional>
+
+struct GeneratorOptions
+{
+    std::string debugFile{};       // source file name, emits %line directives for the DWARF line table when set
+    bool profileGenerate = false;  // count how often every if arm is taken, dumped to s_ProfilePath at exit
+    std::vector<uint64_t> profile{}; // the counters of an earlier --profile-generate run
+    bool avx2 = false;               // element-wise array code uses 256 bit AVX2 vectors instead of SSE2
+    bool checkOnly = false;          // only the compile errors matter, the output is thrown away
+    bool exports = false;            // every function is emitted and global, for the other modules to link against
+    bool library = false;            // an imported module: only its functions are emitted, there is no _start
+};
 
 class CodeGenerator
 {
 private:
     const node::Prog m_Prog;
     mutable std::stringstream m_Output;
+    std::stringstream m_Data; // read only data, emitted after the code (jump tables)
+    std::stringstream m_Cold; // arms the profile says are rarely taken, emitted after everything else
+    bool m_InCold = false;
+    const GeneratorOptions m_Options;
+
+    // every if statement and every arm gets a counter, numbered in source order so the
+    // numbers of an instrumented build match the ones of the build that uses its profile
+    std::map<const void *, size_t> m_Counters{};
+    bool m_UseProfile = false;
     size_t m_CountLabel;
     size_t m_StackPtr; // to keep track where the stack ptr will be at compile time
+    int m_Line = 0;    // source line of the statement being generated
 
     struct Variable
     {
         std::string name;
-        size_t stackPtr; // for the variable, it's posistion in the stack need to known
+        size_t stackPtr;    // for the variable, it's posistion in the stack need to known
+        std::string reg{};  // set when the variable lives in a register instead (induction variables)
+        bool reserved{};    // the slot was reserved in front of a loop, the scope doesn't own it
+        size_t length{};    // element count of an array, 0 for a scalar. stackPtr is the slot of element 0
+        size_t padding{};   // slots in front of an array that align its storage
     };
 
     std::vector<Variable> m_Variables{}; // to keep track the variables, can't declare same variable twice
     std::vector<size_t> m_Scopes{};      // indices to the variables
 
+    std::map<const node::StatementLet *, size_t> m_Reserved{}; // slots of the let statements inside loop bodies
+    std::map<const node::StatementArray *, size_t> m_ReservedArrays{}; // element 0 of the arrays declared inside loop bodies
+    std::set<const node::StatementLet *> m_Hoisted{};           // loop invariant lets, already evaluated in front of the loop
+    size_t m_LoopRegisters = 0;                                 // induction variables currently held in registers
+    size_t m_MaxLoopRegisters = 0;                              // callee saved registers the current function has to preserve
+    static constexpr const char *s_LoopRegisters[] = {"r12", "r13", "r14", "r15"};
+
+    // System V argument registers, a function takes at most 6 arguments
+    static constexpr const char *s_ArgRegisters[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    static constexpr size_t s_InlineLimit = 8; // statements, the inlined callees included
+
+    std::map<std::string, const node::Function *> m_Functions{};
+    std::set<std::string> m_Inline{}; // small functions that are inlined at every call site, and never emitted
+    std::map<std::string, size_t> m_InlineSizes{};  // statements of an inlined function, its inlined callees included
+    std::deque<node::Function> m_Signatures{};      // streamed functions whose nodes were released, only the name and parameters are left
+    std::vector<std::string> m_Imports{};           // functions of other modules, left to the linker
+    std::ostream *m_Stream = nullptr;               // the output of a streamed compilation
+
+    struct FunctionContext
+    {
+        std::string returnLabel;
+        size_t base; // stack ptr of the first parameter, an inlined return drops everything above it
+        bool inlined;
+    };
+
+    // every function body gets its own stack bookkeeping, the caller's is set aside while it is generated
+    struct Frame
+    {
+        size_t stackPtr;
+        std::vector<Variable> variables;
+        std::vector<size_t> scopes;
+        std::optional<FunctionContext> function;
+    };
+
+    std::optional<FunctionContext> m_Function{};
+
+    static constexpr size_t s_MaxArrayLength = 1 << 24; // elements, keeps the frame offsets and the bounds check in an imm32
+    static constexpr size_t s_UnrollVectors = 4;        // element-wise code loops over the vectors beyond this
+    bool m_AlignFrame = false;                          // the current frame holds arrays, its base has to be vector aligned
+    bool m_BoundsCheck = false;                         // some index is checked at runtime, blue_out_of_bounds is needed
+    std::optional<size_t> m_Element{};                  // set by genElement, an array in the expression stands for this element
+
+    Liveness m_Liveness{};
+    bool m_Exited = false; // a streamed top level exit was generated, the statements after it are unreachable
+
+    Frame enterFrame(const size_t stackPtr, const FunctionContext &function)
+    {
+        Frame caller{.stackPtr = m_StackPtr, .variables = std::move(m_Variables), .scopes = std::move(m_Scopes), .function = m_Function};
+        m_StackPtr = stackPtr;
+        m_Variables.clear();
+        m_Scopes.clear();
+        m_Function = function;
+        return caller;
+    }
+
+    void leaveFrame(Frame &caller)
+    {
+        m_StackPtr = caller.stackPtr;
+        m_Variables = std::move(caller.variables);
+        m_Scopes = std::move(caller.scopes);
+        m_Function = caller.function;
+    }
+
     void push(const std::string &reg)
     {
         m_Output << "    PUSH " << reg << "\n";
@@ -39,266 +133,2270 @@ private:
 
     void endScope()
     {
-        const size_t popCount = m_Variables.size() - m_Scopes.back();
+        const size_t varCount = m_Variables.size() - m_Scopes.back();
+        // only the variables that were pushed by the scope itself take a slot it has to release
+        size_t popCount = 0;
+        for (auto var = m_Variables.end() - varCount; var != m_Variables.end(); var++)
+            if (var->reg.empty() && !var->reserved)
+                popCount += var->length ? var->length + var->padding : 1;
         // each of the variable is a 8 bytes b/c we r using 64 bit int and since the stack grows downward in memory by increasing the value of rsp, moving the sp upward in memory, which has the effect of "popping" elements off the stack.
-        m_Output << "    ADD rsp, " << popCount * 8 << "\n";
+        if (popCount > 0)
+            m_Output << "    ADD rsp, " << popCount * 8 << "\n";
         m_StackPtr -= popCount;
 
-        for (size_t i = 0; i < popCount; i++)
+        for (size_t i = 0; i < varCount; i++)
             m_Variables.pop_back();
 
         m_Scopes.pop_back();
     }
 
-    std::string createLabel()
+    // the size of the data should be specified, b/c using 64 bit, it's denoted as QWORD
+    // the offset is in bytes and the stack_ptr is using one for 64 bits so, multiply by 8 to access the element in assembly arr[curr + 8]
+    std::string slot(const size_t stackPtr, const size_t offset = 0) const
+    {
+        return "QWORD [rsp + " + std::to_string((m_StackPtr - stackPtr - 1) * 8 + offset) + "]";
+    }
+
+    std::string location(const Variable &var) const
+    {
+        return var.reg.empty() ? slot(var.stackPtr) : var.reg;
+    }
+
+    // the labels end up as local symbols in the binary, named after what they mark and the source line
+    // so a profiler attributes the samples to something readable
+    std::string createLabel(const std::string &kind)
     {
-        return "label" + std::to_string(m_CountLabel++);
+        return kind + "_l" + std::to_string(m_Line) + "_" + std::to_string(m_CountLabel++);
     }
 
 public:
-    inline CodeGenerator(const node::Prog &prog) : m_Prog(prog), m_StackPtr(0), m_CountLabel(0) {}
+    static constexpr uint64_t s_ProfileMagic = 0x464f525045554c42; // "BLUEPROF"
+    static constexpr const char *s_ProfilePath = "blue.profdata";
 
-    void genTerm(const node::Term *term)
+    inline CodeGenerator(const node::Prog &prog, const GeneratorOptions &options = {}) : m_Prog(prog), m_Options(options), m_CountLabel(0), m_StackPtr(0) {}
+
+    // expressions are generated post-order from an explicit stack of tasks instead of by recursion, so how deep
+    // they nest is only limited by the heap. a node is visited twice: first its operands are scheduled in the
+    // order they're evaluated, then it's finished with their values on top of the machine stack
+    using ExprNode = node::ExprNode;
+
+    struct EvalTask
+    {
+        ExprNode node;
+        bool finish = false;
+    };
+
+    // jumps to label when the condition is true (jumpIf) or false (!jumpIf), falls through otherwise
+    struct BranchTask
+    {
+        ExprNode node;
+        std::string label;
+        bool jumpIf;
+    };
+
+    // the plain code tasks go after the ones scheduled in front of them, like a CMP after its operands
+    using Task = std::variant<EvalTask, BranchTask, std::function<void()>>;
+
+    // the tasks run in the order they're given, ahead of everything that is already on the stack
+    static void schedule(std::vector<Task> &tasks, std::vector<Task> next)
+    {
+        for (auto itr = next.rbegin(); itr != next.rend(); itr++)
+            tasks.push_back(std::move(*itr));
+    }
+
+    struct TermOperandsVisitor
     {
-        struct TermVisitor
+        CodeGenerator &generator;
+        std::vector<Task> &operands;
+        void operator()(const node::TermIntLit *) const {}
+        void operator()(const node::TermIdent *) const {}
+        void operator()(const node::TermParenthesis *termParenthesis) const
         {
-            CodeGenerator &generator;
-            void operator()(const node::TermIntLit *termIntLit) const
-            {
-                // push in int lit value in the stack
-                generator.m_Output << "    MOV rax, " << termIntLit->int_literal.value.value() << "\n";
-                generator.push("rax");
-            }
-            void operator()(const node::TermIdent *termIdent) const
-            {
-                const auto itr = std::ranges::find_if(generator.m_Variables, [&](const Variable& var){return var.name == termIdent->ident.value.value();});
-                // extracting out the value of the varialbe and we need to put copy of it on top of the stack
-                // first check if the variable is declared
-                if (itr == generator.m_Variables.cend())
-                {
-                    std::cerr << "Error : Undeclared Identifier : " << termIdent->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                // get the value from the stack using stack_ptr and push it to on the top of the stack
-                // offset from stack_ptr
-                std::stringstream offset;
-                // the size of the data,(pushed) should be specified, b/c using 64 bit, it's denoted as QWORD
-                // the offset is in bytes and the stack_ptr is using one for 64 bits so, to overcome this multiply by 8 simply to access the next index element in assebmly arr[curr + 8]
-                offset << "QWORD [rsp + " << (generator.m_StackPtr - (*itr).stackPtr - 1) * 8 << "]";
-                generator.push(offset.str());
-            }
-            void operator()(const node::TermParenthesis *termParenthesis) const
+            operands.push_back(EvalTask{node::asNode(termParenthesis->expr)});
+        }
+        void operator()(const node::TermNot *termNot) const
+        {
+            operands.push_back(EvalTask{termNot->term});
+        }
+        void operator()(const node::TermCall *termCall) const
+        {
+            generator.checkCall(termCall);
+            for (const node::Expr *arg : termCall->args)
+                operands.push_back(EvalTask{node::asNode(arg)});
+        }
+        void operator()(const node::TermIndex *termIndex) const
+        {
+            generator.arrayVariable(termIndex->ident);
+            if (!node::asLiteral(termIndex->index).has_value())
+                operands.push_back(EvalTask{node::asNode(termIndex->index)});
+        }
+    };
+
+    struct TermVisitor
+    {
+        CodeGenerator &generator;
+        void operator()(const node::TermIntLit *termIntLit) const
+        {
+            // push in int lit value in the stack
+            generator.m_Output << "    MOV rax, " << termIntLit->int_literal.value.value() << "\n";
+            generator.push("rax");
+        }
+        void operator()(const node::TermIdent *termIdent) const
+        {
+            // extracting out the value of the varialbe and we need to put copy of it on top of the stack
+            const Variable &var = generator.valueVariable(termIdent->ident);
+            if (var.length)
             {
-                generator.genExpr(termParenthesis->expr);
+                generator.push(generator.slot(var.stackPtr, generator.m_Element.value() * 8));
+                return;
             }
-        };
-        TermVisitor visitor{.generator = *this};
-        std::visit(visitor, term->variant);
+            // get the value from the stack using stack_ptr (or from its register) and push it to on the top of the stack
+            generator.push(generator.location(var));
+        }
+        void operator()(const node::TermParenthesis *) const {}
+        void operator()(const node::TermCall *termCall) const
+        {
+            generator.genCallSite(termCall);
+        }
+        void operator()(const node::TermIndex *termIndex) const
+        {
+            generator.genElementLoad(termIndex);
+        }
+        void operator()(const node::TermNot *) const
+        {
+            generator.pop("rax");
+            generator.m_Output << "    TEST rax, rax\n";
+            generator.m_Output << "    SETZ al\n";
+            generator.m_Output << "    MOVZX rax, al\n";
+            generator.push("rax");
+        }
+    };
+
+    struct ExprsOperandsVisitor
+    {
+        CodeGenerator &generator;
+        const node::Exprs *exprs;
+        std::vector<Task> &operands;
+        // the leaves are taken by the instruction as its operands, only the other operands are pushed
+        void pushOperands(const node::Expr *first, const node::Expr *second) const
+        {
+            if (!generator.isOperand(first))
+                operands.push_back(EvalTask{node::asNode(first)});
+            if (!generator.isOperand(second))
+                operands.push_back(EvalTask{node::asNode(second)});
+        }
+        // the right hand side goes first, so the left one ends up on top for the POP into rax
+        template <typename T>
+        void operator()(const T *opr) const
+        {
+            pushOperands(opr->rhs, opr->lhs);
+        }
+        // a + b * scale is a single LEA, the multiplication isn't evaluated on its own
+        void operator()(const node::ExprsAdd *add) const
+        {
+            if (const auto scaled = asScaled(add->rhs))
+                pushOperands(scaled->first, add->lhs);
+            else if (const auto scaled = asScaled(add->lhs))
+                pushOperands(add->rhs, scaled->first);
+            else
+                pushOperands(add->rhs, add->lhs);
+        }
+        // a literal operand of a multiplication or a division is an immediate, it's never pushed
+        void operator()(const node::ExprsMul *mul) const
+        {
+            if (node::asLiteral(mul->rhs).has_value())
+                operands.push_back(EvalTask{node::asNode(mul->lhs)});
+            else if (node::asLiteral(mul->lhs).has_value())
+                operands.push_back(EvalTask{node::asNode(mul->rhs)});
+            else
+                operator()<node::ExprsMul>(mul);
+        }
+        void operator()(const node::ExprsDiv *div) const
+        {
+            const auto value = node::asLiteral(div->rhs);
+            if (value.has_value() && value.value() != 0)
+                operands.push_back(EvalTask{node::asNode(div->lhs)});
+            else
+                operator()<node::ExprsDiv>(div);
+        }
+        // && and || in value position are short circuited through the branch lowering
+        void operator()(const node::ExprsAnd *) const
+        {
+            generator.scheduleLogicalValue(exprs, operands);
+        }
+        void operator()(const node::ExprsOr *) const
+        {
+            generator.scheduleLogicalValue(exprs, operands);
+        }
+    };
+
+    struct ExprsVisitor
+    {
+        CodeGenerator &generator;
+        const node::Exprs *exprs;
+        void operator()(const node::ExprsAdd *add) const
+        {
+            generator.genAdd(add);
+        }
+        void operator()(const node::ExprsSub *sub) const
+        {
+            generator.genSub(sub);
+        }
+        void operator()(const node::ExprsMul *mul) const
+        {
+            generator.genMul(mul);
+        }
+
+        void operator()(const node::ExprsDiv *div) const
+        {
+            generator.genDiv(div);
+        }
+        // comparisons only materialize the flags as 0 or 1 when the value itself is needed,
+        // in a condition the branch lowering jumps on the flags directly
+        void operator()(const node::ExprsEq *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsNotEq *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsLess *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsLessEq *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsGreater *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsGreaterEq *) const
+        {
+            generator.genCompareValue(asComparison(exprs).value());
+        }
+        void operator()(const node::ExprsAnd *) const {}
+        void operator()(const node::ExprsOr *) const {}
+    };
+
+    void scheduleLogicalValue(const node::Exprs *exprs, std::vector<Task> &operands)
+    {
+        const std::string falseLabel = createLabel("bool_false");
+        const std::string endLabel = createLabel("bool_end");
+        operands.push_back(BranchTask{exprs, falseLabel, false});
+        operands.push_back([this, falseLabel, endLabel]
+                           {
+            m_Output << "    MOV rax, 1\n";
+            m_Output << "    JMP " << endLabel << "\n";
+            m_Output << falseLabel << ":\n";
+            m_Output << "    MOV rax, 0\n";
+            m_Output << endLabel << ":\n";
+            push("rax"); });
     }
 
-    void genExprs(const node::Exprs *exprs)
+    void scheduleBranch(const BranchTask &branch, std::vector<Task> &tasks)
     {
-        struct ExprsVisitor
+        const std::string &label = branch.label;
+        const bool jumpIf = branch.jumpIf;
+        const auto test = [this, label, jumpIf]
+        { genTestBranch(label, jumpIf); };
+
+        if (const auto term = std::get_if<const node::Term *>(&branch.node))
         {
-            CodeGenerator &generator;
-            void operator()(const node::ExprsAdd *add) const
+            if (const auto termParenthesis = std::get_if<node::TermParenthesis *>(&(*term)->variant))
+                return schedule(tasks, {BranchTask{node::asNode((*termParenthesis)->expr), label, jumpIf}});
+            if (const auto termNot = std::get_if<node::TermNot *>(&(*term)->variant))
+                return schedule(tasks, {BranchTask{(*termNot)->term, label, !jumpIf}});
+            return schedule(tasks, {EvalTask{*term}, test});
+        }
+
+        const node::Exprs *exprs = std::get<const node::Exprs *>(branch.node);
+        if (const auto comparison = asComparison(exprs))
+        {
+            const std::string cc = jumpIf ? comparison->cc : invertCondition(comparison->cc);
+            std::vector<Task> operands;
+            for (const node::Expr *operand : {comparison->rhs, comparison->lhs})
+                if (!isOperand(operand))
+                    operands.push_back(EvalTask{node::asNode(operand)});
+            operands.push_back([this, lhs = comparison->lhs, rhs = comparison->rhs, cc, label]
+                               {
+                const std::string jcc = genCompare(lhs, rhs, cc);
+                m_Output << "    J" << jcc << " " << label << "\n"; });
+            return schedule(tasks, std::move(operands));
+        }
+        if (const auto exprsAnd = std::get_if<node::ExprsAnd *>(&exprs->variant))
+        {
+            if (!jumpIf)
+                return schedule(tasks, {BranchTask{node::asNode((*exprsAnd)->lhs), label, false}, BranchTask{node::asNode((*exprsAnd)->rhs), label, false}});
+            const std::string skipLabel = createLabel("skip");
+            return schedule(tasks, {BranchTask{node::asNode((*exprsAnd)->lhs), skipLabel, false}, BranchTask{node::asNode((*exprsAnd)->rhs), label, true}, [this, skipLabel]
+                                    { m_Output << skipLabel << ":\n"; }});
+        }
+        if (const auto exprsOr = std::get_if<node::ExprsOr *>(&exprs->variant))
+        {
+            if (jumpIf)
+                return schedule(tasks, {BranchTask{node::asNode((*exprsOr)->lhs), label, true}, BranchTask{node::asNode((*exprsOr)->rhs), label, true}});
+            const std::string skipLabel = createLabel("skip");
+            return schedule(tasks, {BranchTask{node::asNode((*exprsOr)->lhs), skipLabel, true}, BranchTask{node::asNode((*exprsOr)->rhs), label, false}, [this, skipLabel]
+                                    { m_Output << skipLabel << ":\n"; }});
+        }
+        schedule(tasks, {EvalTask{exprs}, test});
+    }
+
+    void runTasks(std::vector<Task> tasks)
+    {
+        while (!tasks.empty())
+        {
+            Task task = std::move(tasks.back());
+            tasks.pop_back();
+            if (const auto code = std::get_if<std::function<void()>>(&task))
             {
-                generator.genExpr(add->rhs);
-                generator.genExpr(add->lhs);
-                generator.pop("rax");
-                generator.pop("rbx");
-                generator.m_Output << "    ADD rax, rbx\n";
-                generator.push("rax");
+                (*code)();
+                continue;
             }
-            void operator()(const node::ExprsSub *sub) const
+            if (const auto branch = std::get_if<BranchTask>(&task))
             {
-                generator.genExpr(sub->rhs);
-                generator.genExpr(sub->lhs);
-                generator.pop("rax");
-                generator.pop("rbx");
-                generator.m_Output << "    SUB rax, rbx\n";
-                generator.push("rax");
+                scheduleBranch(*branch, tasks);
+                continue;
             }
-            void operator()(const node::ExprsMul *mul) const
+
+            const EvalTask eval = std::get<EvalTask>(task);
+            const auto term = std::get_if<const node::Term *>(&eval.node);
+            const auto exprs = std::get_if<const node::Exprs *>(&eval.node);
+            if (eval.finish)
             {
-                generator.genExpr(mul->rhs);
-                generator.genExpr(mul->lhs);
-                generator.pop("rax");
-                generator.pop("rbx");
-                generator.m_Output << "    MUL rbx\n";
-                generator.push("rax");
+                if (term)
+                    std::visit(TermVisitor{.generator = *this}, (*term)->variant);
+                else
+                    std::visit(ExprsVisitor{.generator = *this, .exprs = *exprs}, (*exprs)->variant);
+                continue;
             }
+            std::vector<Task> operands;
+            if (term)
+                std::visit(TermOperandsVisitor{.generator = *this, .operands = operands}, (*term)->variant);
+            else
+                std::visit(ExprsOperandsVisitor{.generator = *this, .exprs = *exprs, .operands = operands}, (*exprs)->variant);
+            tasks.push_back(EvalTask{eval.node, true});
+            schedule(tasks, std::move(operands));
+        }
+    }
+
+    void genTerm(const node::Term *term)
+    {
+        runTasks({EvalTask{term}});
+    }
+
+    void genExprs(const node::Exprs *exprs)
+    {
+        runTasks({EvalTask{exprs}});
+    }
+
+    void genExpr(const node::Expr *expr)
+    {
+        runTasks({EvalTask{node::asNode(expr)}});
+    }
+
+    void genScope(const node::Scope *scope)
+    {
+        beginScope();
+        const size_t count = node::reachableCount(scope->statements);
+        for (size_t i = 0; i < count; i++)
+            genStatement(scope->statements[i]);
+        checkUnreachable(scope->statements, count);
+
+        endScope();
+    }
+
+    // the statements after an exit or return are never run, but they are still checked: generated into
+    // buffers that are thrown away. the variables they declare are kept, the statements after them can use them
+    void checkUnreachable(const std::vector<node::Statement *> &statements, const size_t begin)
+    {
+        std::stringstream output, data, cold;
+        m_Output.swap(output);
+        m_Data.swap(data);
+        m_Cold.swap(cold);
+        const bool boundsCheck = m_BoundsCheck;
+        for (size_t i = begin; i < statements.size(); i++)
+            genStatement(statements[i]);
+        m_Output.swap(output);
+        m_Data.swap(data);
+        m_Cold.swap(cold);
+        m_BoundsCheck = boundsCheck;
+    }
 
-            void operator()(const node::ExprsDiv *div) const
+    // what generating the store of a dead store would report, its value isn't needed but its names are checked
+    void checkStore(const Variable &target, const node::Expr *expr) const
+    {
+        if (target.length)
+            return checkElementwise(expr, target.length);
+        node::walkExpr(expr, [&](const ExprNode &node)
+                       {
+            const auto term = std::get_if<const node::Term *>(&node);
+            if (!term)
+                return true;
+            if (const auto termIdent = std::get_if<node::TermIdent *>(&(*term)->variant))
+                valueVariable((*termIdent)->ident);
+            else if (const auto termIndex = std::get_if<node::TermIndex *>(&(*term)->variant))
             {
-                generator.genExpr(div->rhs);
-                generator.genExpr(div->lhs);
-                generator.pop("rax");
-                generator.pop("rbx");
-                generator.m_Output << "    DIV rbx\n";
-                generator.push("rax");
+                const Variable var = arrayVariable((*termIndex)->ident);
+                if (const auto index = node::asLiteral((*termIndex)->index))
+                    checkIndex(var, *index);
             }
-        };
+            else if (const auto termCall = std::get_if<node::TermCall *>(&(*term)->variant))
+                checkCall(*termCall);
+            return true; });
+    }
+
+    using Branch = node::Branch;
 
-        ExprsVisitor visitor{.generator = *this};
-        std::visit(visitor, exprs->variant);
+    // a scope that reaches exit or return never reaches the code after it, so it doesn't need a jump to the end of the chain
+    static bool fallsThrough(const node::Scope *scope)
+    {
+        return std::ranges::none_of(scope->statements, node::isExit);
     }
 
-    void genExpr(const node::Expr *expr)
+    // a leaf an instruction takes as its operand as it is, nothing is pushed for it: a literal that fits the sign
+    // extended imm32, a scalar variable (its slot or its register) or the current element of an array in element-wise code
+    bool isOperand(const node::Expr *expr) const
+    {
+        if (const auto value = node::asLiteral(expr))
+            return value.value() <= INT32_MAX;
+        const node::Term *term = node::asTerm(expr);
+        const auto termIdent = term ? std::get_if<node::TermIdent *>(&term->variant) : nullptr;
+        if (!termIdent)
+            return false;
+        // an undeclared variable or an array used as a value is left to TermVisitor, it reports them
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                              { return var.name == (*termIdent)->ident.value.value(); });
+        return itr != m_Variables.end() && (!itr->length || m_Element.has_value());
+    }
+
+    // where the leaf is right now, the stack pointer has to be the one of the instruction that uses it
+    std::string operand(const node::Expr *expr) const
+    {
+        if (const auto value = node::asLiteral(expr))
+            return std::to_string(value.value());
+        const std::string &name = std::get<node::TermIdent *>(node::asTerm(expr)->variant)->ident.value.value();
+        const Variable &var = *std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                                    { return var.name == name; });
+        return var.length ? slot(var.stackPtr, m_Element.value() * 8) : location(var);
+    }
+
+    static bool isRegister(const std::string &operand)
     {
+        return std::isalpha(operand.front()) && operand.find('[') == std::string::npos;
+    }
+
+    // rax = lhs and the returned operand holds rhs. the operands that aren't leaves are popped, lhs was on top
+    std::string genOperands(const node::Expr *lhs, const node::Expr *rhs)
+    {
+        std::string right = "rbx";
+        if (!isOperand(lhs))
+            pop("rax");
+        if (!isOperand(rhs))
+            pop("rbx");
+        else
+            right = operand(rhs);
+        if (isOperand(lhs))
+            m_Output << "    MOV rax, " << operand(lhs) << "\n";
+        return right;
+    }
 
-        struct ExprVisitor
+    // x * 2, 4 or 8, either way around: the index and scale of an LEA
+    static std::optional<std::pair<const node::Expr *, uint64_t>> asScaled(const node::Expr *expr)
+    {
+        const auto exprs = std::get_if<node::Exprs *>(&node::stripParenthesis(expr)->variant);
+        const auto mul = exprs ? std::get_if<node::ExprsMul *>(&(*exprs)->variant) : nullptr;
+        if (!mul)
+            return {};
+        for (const auto &[value, factor] : {std::pair{(*mul)->lhs, (*mul)->rhs}, std::pair{(*mul)->rhs, (*mul)->lhs}})
+            if (const auto scale = node::asLiteral(factor); scale == 2u || scale == 4u || scale == 8u)
+                return std::pair{value, scale.value()};
+        return {};
+    }
+
+    void genAdd(const node::ExprsAdd *add)
+    {
+        // base + index * scale, the operand on top of the stack ends up in rax, the other one has to be a register
+        const auto genLea = [&](const node::Expr *top, const node::Expr *below, const uint64_t scale, const bool indexOnTop)
         {
-            CodeGenerator &generator;
-            void operator()(const node::Term *term) const
+            std::string other = genOperands(top, below);
+            if (!isRegister(other))
             {
-                generator.genTerm(term);
+                m_Output << "    MOV rbx, " << other << "\n";
+                other = "rbx";
             }
+            if (indexOnTop)
+                m_Output << "    LEA rax, [" << other << " + rax * " << scale << "]\n";
+            else
+                m_Output << "    LEA rax, [rax + " << other << " * " << scale << "]\n";
+            push("rax");
+        };
+        if (const auto scaled = asScaled(add->rhs))
+            return genLea(add->lhs, scaled->first, scaled->second, false);
+        if (const auto scaled = asScaled(add->lhs))
+            return genLea(scaled->first, add->rhs, scaled->second, true);
+
+        // a leaf on the left is added to the right hand side instead, there is nothing to load for it
+        const std::string right = isOperand(add->lhs) && !isOperand(add->rhs) ? genOperands(add->rhs, add->lhs) : genOperands(add->lhs, add->rhs);
+        if (right == "1")
+            m_Output << "    INC rax\n";
+        else
+            m_Output << "    ADD rax, " << right << "\n";
+        push("rax");
+    }
+
+    void genSub(const node::ExprsSub *sub)
+    {
+        if (node::asLiteral(sub->lhs) == 0u)
+        {
+            if (isOperand(sub->rhs))
+                m_Output << "    MOV rax, " << operand(sub->rhs) << "\n";
+            else
+                pop("rax");
+            m_Output << "    NEG rax\n";
+            push("rax");
+            return;
+        }
+        const std::string right = genOperands(sub->lhs, sub->rhs);
+        if (right == "1")
+            m_Output << "    DEC rax\n";
+        else
+            m_Output << "    SUB rax, " << right << "\n";
+        push("rax");
+    }
+
+    // rax *= value, with the shift/LEA forms where they apply
+    void genMulImmediate(const uint64_t value)
+    {
+        if (value == 0)
+        {
+            m_Output << "    MOV rax, 0\n";
+            return;
+        }
+        // value = (1, 3, 5 or 9) << shift
+        const unsigned shift = std::countr_zero(value);
+        const uint64_t odd = value >> shift;
+        if (odd == 1 || odd == 3 || odd == 5 || odd == 9)
+        {
+            if (odd != 1)
+                m_Output << "    LEA rax, [rax + rax * " << odd - 1 << "]\n";
+            if (shift > 0)
+                m_Output << "    SHL rax, " << shift << "\n";
+            return;
+        }
+        if (value <= INT32_MAX)
+        {
+            m_Output << "    IMUL rax, rax, " << value << "\n";
+            return;
+        }
+        m_Output << "    MOV rbx, " << value << "\n";
+        m_Output << "    IMUL rax, rbx\n";
+    }
+
+    // the low 64 bits of a product are the same signed or unsigned, so the two operand IMUL
+    // gives the same result as MUL without clobbering rdx. a literal operand was never pushed
+    void genMul(const node::ExprsMul *mul)
+    {
+        const auto value = node::asLiteral(mul->rhs).has_value() ? node::asLiteral(mul->rhs) : node::asLiteral(mul->lhs);
+        if (value.has_value())
+        {
+            pop("rax");
+            genMulImmediate(value.value());
+            push("rax");
+            return;
+        }
+        const std::string right = genOperands(mul->lhs, mul->rhs);
+        m_Output << "    IMUL rax, " << right << "\n";
+        push("rax");
+    }
+
+    struct MagicDivisor
+    {
+        uint64_t magic;
+        unsigned shift;
+        bool add; // the magic number needs 65 bits, the quotient gets an extra add and halving step
+    };
+
+    // n / divisor == mulhi(magic, n) >> shift, for any 64 bit n (Granlund-Montgomery).
+    // the divisor must not be 0 or a power of 2
+    static MagicDivisor magicDivisor(const uint64_t divisor)
+    {
+        const unsigned log2 = 63 - std::countl_zero(divisor);
+        const unsigned __int128 numerator = static_cast<unsigned __int128>(1) << (64 + log2);
+        uint64_t magic = static_cast<uint64_t>(numerator / divisor);
+        const uint64_t rem = static_cast<uint64_t>(numerator % divisor);
+        if (divisor - rem < (uint64_t{1} << log2))
+            return {.magic = magic + 1, .shift = log2, .add = false};
+
+        magic += magic;
+        const uint64_t twiceRem = rem + rem;
+        if (twiceRem >= divisor || twiceRem < rem)
+            magic++;
+        return {.magic = magic + 1, .shift = log2, .add = true};
+    }
 
-            void operator()(const node::Exprs *exprs) const
+    // division by a literal never goes through DIV, except for 0 which has to trap like before
+    void genDiv(const node::ExprsDiv *div)
+    {
+        const auto value = node::asLiteral(div->rhs);
+        if (!value.has_value() || value.value() == 0)
+        {
+            std::string divisor = genOperands(div->lhs, div->rhs);
+            // DIV has no immediate form
+            if (std::isdigit(divisor.front()))
             {
-                generator.genExprs(exprs);
+                m_Output << "    MOV rbx, " << divisor << "\n";
+                divisor = "rbx";
             }
-        };
+            m_Output << "    XOR rdx, rdx\n";
+            m_Output << "    DIV " << divisor << "\n";
+            push("rax");
+            return;
+        }
+        pop("rax");
 
-        ExprVisitor visitor{.generator = *this};
-        // if expr.variant is intlit it calls the overloaded operator with ExprIntLit params, or if it's ExprIdent it calls the overloaded operator with ExprIdent
-        std::visit(visitor, expr->variant);
+        if (std::has_single_bit(value.value()))
+        {
+            if (value.value() > 1)
+                m_Output << "    SHR rax, " << std::countr_zero(value.value()) << "\n";
+            push("rax");
+            return;
+        }
+
+        const MagicDivisor magic = magicDivisor(value.value());
+        // the MUL overwrites n, only the add step needs it afterwards
+        if (magic.add)
+            m_Output << "    MOV rbx, rax\n";
+        m_Output << "    MOV rdx, " << magic.magic << "\n";
+        m_Output << "    MUL rdx\n";
+        if (magic.add)
+        {
+            // ((n - q) / 2 + q) >> shift, q being the high half of the product
+            m_Output << "    MOV rax, rbx\n";
+            m_Output << "    SUB rax, rdx\n";
+            m_Output << "    SHR rax, 1\n";
+            m_Output << "    ADD rax, rdx\n";
+        }
+        else
+        {
+            m_Output << "    MOV rax, rdx\n";
+        }
+        if (magic.shift > 0)
+            m_Output << "    SHR rax, " << magic.shift << "\n";
+        push("rax");
     }
 
-    void genScope(const node::Scope *scope)
+    // every comparison is unsigned, like the rest of the arithmetic
+    struct Comparison
     {
-        beginScope();
-        for (const node::Statement *statement : scope->statements)
-            genStatement(statement);
+        const node::Expr *lhs, *rhs;
+        std::string cc; // condition code that holds when the comparison is true
+    };
 
-        endScope();
+    static std::optional<Comparison> asComparison(const node::Exprs *exprs)
+    {
+        if (const auto eq = std::get_if<node::ExprsEq *>(&exprs->variant))
+            return Comparison{(*eq)->lhs, (*eq)->rhs, "E"};
+        if (const auto notEq = std::get_if<node::ExprsNotEq *>(&exprs->variant))
+            return Comparison{(*notEq)->lhs, (*notEq)->rhs, "NE"};
+        if (const auto less = std::get_if<node::ExprsLess *>(&exprs->variant))
+            return Comparison{(*less)->lhs, (*less)->rhs, "B"};
+        if (const auto lessEq = std::get_if<node::ExprsLessEq *>(&exprs->variant))
+            return Comparison{(*lessEq)->lhs, (*lessEq)->rhs, "BE"};
+        if (const auto greater = std::get_if<node::ExprsGreater *>(&exprs->variant))
+            return Comparison{(*greater)->lhs, (*greater)->rhs, "A"};
+        if (const auto greaterEq = std::get_if<node::ExprsGreaterEq *>(&exprs->variant))
+            return Comparison{(*greaterEq)->lhs, (*greaterEq)->rhs, "AE"};
+        return {};
+    }
+
+    static std::string invertCondition(const std::string &cc)
+    {
+        static const std::map<std::string, std::string> inverse = {
+            {"E", "NE"}, {"NE", "E"}, {"B", "AE"}, {"AE", "B"}, {"BE", "A"}, {"A", "BE"}};
+        return inverse.at(cc);
     }
 
-    void genConditionalBr(const node::ConditionalBranch *conditionalBr, const std::string &endLabel)
+    // the condition that holds for the operands the other way around
+    static std::string swapCondition(const std::string &cc)
     {
+        static const std::map<std::string, std::string> swapped = {
+            {"E", "E"}, {"NE", "NE"}, {"B", "A"}, {"A", "B"}, {"BE", "AE"}, {"AE", "BE"}};
+        return swapped.at(cc);
+    }
 
-        struct ConditionalBranchVisitor
+    // CMP lhs, rhs with the operands that aren't leaves on the stack, lhs on top. returns the condition code
+    // to test, swapped when the operands are. a variable compared to a literal doesn't go through a register
+    std::string genCompare(const node::Expr *lhs, const node::Expr *rhs, const std::string &cc)
+    {
+        if (isOperand(lhs) && !node::asLiteral(lhs).has_value() && node::asLiteral(rhs).has_value() && isOperand(rhs))
         {
-            CodeGenerator &generator;
-            const std::string &endLabel;
+            m_Output << "    CMP " << operand(lhs) << ", " << operand(rhs) << "\n";
+            return cc;
+        }
+        if (isOperand(lhs) && !isOperand(rhs))
+        {
+            pop("rax");
+            m_Output << "    CMP rax, " << operand(lhs) << "\n";
+            return swapCondition(cc);
+        }
+        const std::string right = genOperands(lhs, rhs);
+        m_Output << "    CMP rax, " << right << "\n";
+        return cc;
+    }
 
-            void operator()(const node::ConditionalBranchElif *conditionalBrElif) const
-            {
-                generator.genExpr(conditionalBrElif->expr);
-                generator.pop("rax");
-                const std::string label = generator.createLabel();
-                generator.m_Output << "    TEST rax, rax\n";
-                generator.m_Output << "    JZ " << label << "\n";
-                generator.genScope(conditionalBrElif->scope);
-                // as soon as one of the elif statement is true, jump the rest
-                generator.m_Output << "    JMP " << endLabel << "\n";
+    // the operands that aren't leaves are on the stack, lhs on top
+    void genCompareValue(const Comparison &comparison)
+    {
+        const std::string cc = genCompare(comparison.lhs, comparison.rhs, comparison.cc);
+        m_Output << "    SET" << cc << " al\n";
+        m_Output << "    MOVZX rax, al\n";
+        push("rax");
+    }
 
-                if (conditionalBrElif->conditionalBr.has_value())
-                {
-                    generator.m_Output << label << ":\n";
-                    generator.genConditionalBr(conditionalBrElif->conditionalBr.value(), endLabel);
-                }
-            }
-            void operator()(const node::ConditionalBranchElse *conditionalBrElse) const
+    // pops the value and jumps to label when it is non zero (jumpIf) or zero (!jumpIf)
+    void genTestBranch(const std::string &label, const bool jumpIf)
+    {
+        pop("rax");
+        m_Output << "    TEST rax, rax\n";
+        m_Output << "    " << (jumpIf ? "JNZ " : "JZ ") << label << "\n";
+    }
+
+    // jumps to label when the condition is true (jumpIf) or false (!jumpIf), falls through otherwise
+    void genBranch(const node::Expr *expr, const std::string &label, const bool jumpIf = false)
+    {
+        runTasks({BranchTask{node::asNode(expr), label, jumpIf}});
+    }
+
+    struct Case
+    {
+        uint64_t value;
+        size_t branch;
+    };
+
+    // matches `ident == literal` and `literal == ident`
+    static std::optional<std::pair<const node::Term *, uint64_t>> asCase(const node::Expr *expr)
+    {
+        const auto exprs = std::get_if<node::Exprs *>(&node::stripParenthesis(expr)->variant);
+        if (!exprs)
+            return {};
+        const auto eq = std::get_if<node::ExprsEq *>(&(*exprs)->variant);
+        if (!eq)
+            return {};
+        const node::Term *lhs = node::asTerm((*eq)->lhs);
+        const node::Term *rhs = node::asTerm((*eq)->rhs);
+        if (!lhs || !rhs)
+            return {};
+        if (std::holds_alternative<node::TermIntLit *>(lhs->variant))
+            std::swap(lhs, rhs);
+        const auto ident = std::get_if<node::TermIdent *>(&lhs->variant);
+        const auto intLit = std::get_if<node::TermIntLit *>(&rhs->variant);
+        if (!ident || !intLit)
+            return {};
+        return std::make_pair(lhs, std::stoull((*intLit)->int_literal.value.value()));
+    }
+
+    // rax OP value, going through rbx when the value doesn't fit a sign extended imm32
+    void genImmediate(const std::string &opr, const uint64_t value)
+    {
+        if (value <= INT32_MAX)
+        {
+            m_Output << "    " << opr << " rax, " << value << "\n";
+            return;
+        }
+        m_Output << "    MOV rbx, " << value << "\n";
+        m_Output << "    " << opr << " rax, rbx\n";
+    }
+
+    void genSearch(const std::vector<Case> &cases, const size_t lo, const size_t hi, const std::vector<std::string> &armLabels, const std::string &defaultLabel)
+    {
+        if (hi - lo <= 3)
+        {
+            for (size_t i = lo; i < hi; i++)
             {
-                generator.genScope(conditionalBrElse->scope);
+                genImmediate("CMP", cases[i].value);
+                m_Output << "    JE " << armLabels[cases[i].branch] << "\n";
             }
-        };
+            m_Output << "    JMP " << defaultLabel << "\n";
+            return;
+        }
+        const size_t mid = lo + (hi - lo) / 2;
+        const std::string lessLabel = createLabel("case_less");
+        genImmediate("CMP", cases[mid].value);
+        m_Output << "    JE " << armLabels[cases[mid].branch] << "\n";
+        m_Output << "    JB " << lessLabel << "\n";
+        genSearch(cases, mid + 1, hi, armLabels, defaultLabel);
+        m_Output << lessLabel << ":\n";
+        genSearch(cases, lo, mid, armLabels, defaultLabel);
+    }
 
-        ConditionalBranchVisitor visitor{.generator = *this, .endLabel = endLabel};
-        std::visit(visitor, conditionalBr->variant);
+    // every arm but a trailing else compares the same variable against a distinct constant
+    static bool isCaseLadder(const std::vector<Branch> &branches)
+    {
+        const size_t count = branches.back().expr ? branches.size() : branches.size() - 1;
+        std::string ident;
+        std::set<uint64_t> values;
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto match = asCase(branches[i].expr);
+            if (!match.has_value())
+                return false;
+            const std::string &name = std::get<node::TermIdent *>(match->first->variant)->ident.value.value();
+            if ((i > 0 && name != ident) || !values.insert(match->second).second)
+                return false;
+            ident = name;
+        }
+        return count > 0;
     }
-    void genStatement(const node::Statement *statement)
+
+    // an elif ladder that compares one variable against constants is lowered to a jump table
+    // when the constants are dense, and to a binary search over them otherwise
+    bool genDispatch(const std::vector<Branch> &branches, const uint64_t entryCount)
     {
-        struct StatementVisitor
+        const bool hasElse = !branches.back().expr;
+        const size_t count = hasElse ? branches.size() - 1 : branches.size();
+        if (count < 4)
+            return false;
+
+        const node::Term *ident = nullptr;
+        std::vector<Case> cases;
+        for (size_t i = 0; i < count; i++)
         {
-            CodeGenerator &generator;
-            void operator()(const node::StatementExit *statementExit) const
+            const auto match = asCase(branches[i].expr);
+            if (!match.has_value())
+                return false;
+            const std::string &name = std::get<node::TermIdent *>(match->first->variant)->ident.value.value();
+            if (ident && std::get<node::TermIdent *>(ident->variant)->ident.value.value() != name)
+                return false;
+            ident = match->first;
+            // the first arm testing a value wins, the later ones are dead
+            if (std::ranges::none_of(cases, [&](const Case &c) { return c.value == match->second; }))
+                cases.push_back({.value = match->second, .branch = i});
+        }
+        std::ranges::sort(cases, {}, &Case::value);
+
+        const std::string endLabel = createLabel("case_end");
+        std::vector<std::string> armLabels;
+        for (size_t i = 0; i < branches.size(); i++)
+            armLabels.push_back(createLabel("case"));
+        const std::string &defaultLabel = hasElse ? armLabels.back() : endLabel;
+
+        genTerm(ident);
+        pop("rax");
+        // a value the profile says dominates is tested before the table or the search
+        if (m_UseProfile)
+        {
+            const auto hottest = std::ranges::max_element(cases, {}, [&](const Case &c)
+                                                          { return profileCount(branches[c.branch].scope); });
+            if (profileCount(branches[hottest->branch].scope) * 2 > entryCount)
             {
-                generator.genExpr(statementExit->expr);
-                generator.m_Output << "    MOV rax, 60\n";
-                generator.pop("rdi");
-                generator.m_Output << "    syscall\n";
+                genImmediate("CMP", hottest->value);
+                m_Output << "    JE " << armLabels[hottest->branch] << "\n";
             }
-            void operator()(const node::StatementLet *statementLet) const
+        }
+        const uint64_t range = cases.back().value - cases.front().value;
+        if (range < 3 * cases.size() && range < 4096)
+        {
+            const std::string tableLabel = createLabel("case_table");
+            if (cases.front().value != 0)
+                genImmediate("SUB", cases.front().value);
+            genImmediate("CMP", range);
+            m_Output << "    JA " << defaultLabel << "\n";
+            m_Output << "    JMP [" << tableLabel << " + rax * 8]\n";
+
+            m_Data << tableLabel << ":\n";
+            auto itr = cases.begin();
+            for (uint64_t value = cases.front().value; value <= cases.back().value; value++)
             {
-                const auto itr = std::ranges::find_if(generator.m_Variables, [&](const Variable& var){return var.name == statementLet->ident.value.value();});
-                // encounter with let statement, first need to check to make sure that there is not a variable declared with that name
-                if (itr != generator.m_Variables.cend())
-                {
-                    std::cerr << "Error :  Redeclaration of variable : " << statementLet->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                // copy the value of the stack at stack_ptr and push it on the top of the stack and then
-                // when exit is called simply pop it from the stack.
-                generator.m_Variables.push_back({.name = statementLet->ident.value.value(), .stackPtr = generator.m_StackPtr});
-                // evaluate the expression
-                generator.genExpr(statementLet->expr); // now the value of the expression is on the top of the stack
+                const bool hit = itr->value == value;
+                m_Data << "    dq " << (hit ? armLabels[itr->branch] : defaultLabel) << "\n";
+                if (hit)
+                    itr++;
             }
-            void operator()(const node::Scope *scope) const
+        }
+        else
+        {
+            genSearch(cases, 0, cases.size(), armLabels, defaultLabel);
+        }
+
+        for (size_t i = 0; i < branches.size(); i++)
+        {
+            const bool reachable = i == count || std::ranges::any_of(cases, [&](const Case &c) { return c.branch == i; });
+            if (!reachable)
+                continue;
+            m_Output << armLabels[i] << ":\n";
+            genCounter(branches[i].scope);
+            genScope(branches[i].scope);
+            if (i + 1 < branches.size() && fallsThrough(branches[i].scope))
+                m_Output << "    JMP " << endLabel << "\n";
+        }
+        m_Output << endLabel << ":\n";
+        return true;
+    }
+
+    void genIfChain(const std::vector<Branch> &branches, const uint64_t entryCount)
+    {
+        if (genDispatch(branches, entryCount))
+            return;
+
+        const std::string endLabel = createLabel("if_end");
+        uint64_t reachCount = entryCount;
+        for (size_t i = 0; i < branches.size(); i++)
+        {
+            const bool last = i + 1 == branches.size();
+            const uint64_t count = profileCount(branches[i].scope);
+            // an arm taken less often than its test falls past it is laid out of line,
+            // so the likely path is the fall through one
+            if (m_UseProfile && !m_InCold && !last && count * 2 < reachCount)
             {
-                generator.genScope(scope);
+                const std::string coldLabel = createLabel("if_cold");
+                genBranch(branches[i].expr, coldLabel, true);
+                m_Output.swap(m_Cold);
+                m_InCold = true;
+                m_Output << coldLabel << ":\n";
+                genCounter(branches[i].scope);
+                genScope(branches[i].scope);
+                if (fallsThrough(branches[i].scope))
+                    m_Output << "    JMP " << endLabel << "\n";
+                m_InCold = false;
+                m_Output.swap(m_Cold);
+                reachCount -= std::min(count, reachCount);
+                continue;
             }
-            void operator()(const node::StatementIf *statementIf) const
+            // the last arm falls through to the end of the chain, the others continue with the next test
+            const std::string nextLabel = last ? endLabel : createLabel("if_next");
+            if (branches[i].expr)
+                genBranch(branches[i].expr, nextLabel);
+            genCounter(branches[i].scope);
+            genScope(branches[i].scope);
+            reachCount -= std::min(count, reachCount);
+            if (last)
+                break;
+            // a rarely taken else goes out of line too, the arm before it falls through to the end
+            const bool coldElse = i + 2 == branches.size() && !branches.back().expr;
+            if (m_UseProfile && !m_InCold && coldElse && profileCount(branches.back().scope) * 2 < count)
             {
-                // evaluate the expression first
-                generator.genExpr(statementIf->expr); // this will put the result of the expression at the stuck top
-                generator.pop("rax");                 // pop back in to the rax, if it's 0 jump, else go to the label
-                const std::string label = generator.createLabel();
-                generator.m_Output << "    TEST rax, rax\n";
-                generator.m_Output << "    JZ " << label << "\n"; // jamp the scope, if it's zero
-                generator.genScope(statementIf->scope);
-                if (statementIf->conditionalBr.has_value())
-                {
-                    const std::string endLabel = generator.createLabel();
-                    generator.m_Output << "    JMP " << endLabel << "\n";
-                    generator.m_Output << label << ":\n";
-                    generator.genConditionalBr(statementIf->conditionalBr.value(), endLabel);
-                    generator.m_Output << endLabel << ":\n";
-                }
-                else
-                {
-                    generator.m_Output << label << ":\n";
-                }
-                generator.m_Output << "    ;;/if\n";
+                m_Output.swap(m_Cold);
+                m_InCold = true;
+                m_Output << nextLabel << ":\n";
+                genCounter(branches.back().scope);
+                genScope(branches.back().scope);
+                if (fallsThrough(branches.back().scope))
+                    m_Output << "    JMP " << endLabel << "\n";
+                m_InCold = false;
+                m_Output.swap(m_Cold);
+                break;
             }
+            // as soon as one of the arms is taken, jump the rest
+            if (fallsThrough(branches[i].scope))
+                m_Output << "    JMP " << endLabel << "\n";
+            m_Output << nextLabel << ":\n";
+        }
+        m_Output << endLabel << ":\n";
+    }
 
-            void operator()(const node::StatementAssignment *statementAssign) const
-            {
-                // in order to assing a variable, first check if it exist in the Variable vector
-                const auto itr = std::ranges::find_if(generator.m_Variables, [&](const Variable &var)
-                                                      { return var.name == statementAssign->ident.value.value(); });
-                if (itr == generator.m_Variables.end())
-                {
-                    std::cerr << "Error : Undeclared Identifier" << statementAssign->ident.value.value() << std::endl;
-                    exit(EXIT_FAILURE);
+    void genIf(const node::StatementIf *statementIf)
+    {
+        std::vector<Branch> branches{{.expr = statementIf->expr, .scope = statementIf->scope}};
+        if (statementIf->conditionalBr.has_value())
+            node::collectBranches(statementIf->conditionalBr.value(), branches);
+
+        genCounter(statementIf);
+        if (m_UseProfile && isCaseLadder(branches))
+        {
+            // the tests of a ladder over distinct constants are mutually exclusive, so they can be
+            // reordered to test the most frequent values first
+            const auto end = branches.back().expr ? branches.end() : branches.end() - 1;
+            std::stable_sort(branches.begin(), end, [&](const Branch &lhs, const Branch &rhs)
+                             { return profileCount(lhs.scope) > profileCount(rhs.scope); });
+        }
+        genIfChain(branches, profileCount(statementIf));
+    }
+
+    // the counters live in .data behind a two word header: magic and count, which is also the layout of the profile file
+    void genCounter(const void *key)
+    {
+        if (m_Options.profileGenerate)
+            m_Output << "    INC QWORD [blue_profile + " << (m_Counters.at(key) + 2) * 8 << "]\n";
+    }
+
+    uint64_t profileCount(const void *key) const
+    {
+        if (!m_UseProfile)
+            return 0;
+        return m_Options.profile[m_Counters.at(key) + 2];
+    }
+
+    void numberCounters(const std::vector<node::Statement *> &statements)
+    {
+        for (const node::Statement *statement : statements)
+        {
+            if (const auto nested = std::get_if<node::Scope *>(&statement->variant))
+                numberCounters((*nested)->statements);
+            else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            {
+                m_Counters.emplace(*statementIf, m_Counters.size());
+                std::vector<Branch> branches{{.expr = (*statementIf)->expr, .scope = (*statementIf)->scope}};
+                if ((*statementIf)->conditionalBr.has_value())
+                    node::collectBranches((*statementIf)->conditionalBr.value(), branches);
+                for (const Branch &branch : branches)
+                {
+                    m_Counters.emplace(branch.scope, m_Counters.size());
+                    numberCounters(branch.scope->statements);
                 }
+            }
+            else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+                numberCounters((*statementWhile)->scope->statements);
+            else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+                numberCounters((*statementFor)->scope->statements);
+        }
+    }
 
-                // not checking for type, everything is int for now
-                generator.genExpr(statementAssign->expr);
-                generator.pop("rax"); // put the result of the above expr to the rax
-                generator.m_Output << "    MOV[rsp + " << (generator.m_StackPtr - itr->stackPtr - 1) * 8 << "], rax\n";
+    // exit code in rdi
+    void genExit()
+    {
+        if (m_Options.profileGenerate)
+        {
+            m_Output << "    MOV rbx, rdi\n";
+            m_Output << "    CALL blue_profile_dump\n";
+            m_Output << "    MOV rdi, rbx\n";
+        }
+        m_Output << "    MOV rax, 60\n";
+        m_Output << "    syscall\n";
+    }
+
+    // open(s_ProfilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644), write the counters, close
+    void genProfileDump()
+    {
+        const size_t size = (m_Counters.size() + 2) * 8;
+        m_Output << "blue_profile_dump:\n";
+        m_Output << "    MOV rax, 2\n";
+        m_Output << "    MOV rdi, blue_profile_path\n";
+        m_Output << "    MOV rsi, 577\n";
+        m_Output << "    MOV rdx, 420\n";
+        m_Output << "    syscall\n";
+        m_Output << "    MOV rdi, rax\n";
+        m_Output << "    MOV rax, 1\n";
+        m_Output << "    MOV rsi, blue_profile\n";
+        m_Output << "    MOV rdx, " << size << "\n";
+        m_Output << "    syscall\n";
+        m_Output << "    MOV rax, 3\n";
+        m_Output << "    syscall\n";
+        m_Output << "    RET\n";
+
+        m_Data << "blue_profile_path:\n";
+        m_Data << "    db \"" << s_ProfilePath << "\", 0\n";
+    }
+
+    void genLine(const int line)
+    {
+        m_Line = line;
+        if (!m_Options.debugFile.empty())
+            m_Output << "%line " << line << "+0 " << m_Options.debugFile << "\n";
+    }
+
+    void genStatement(const node::Statement *statement)
+    {
+        genLine(statement->line);
+        struct StatementVisitor
+        {
+            CodeGenerator &generator;
+            void operator()(const node::StatementExit *statementExit) const
+            {
+                generator.genExpr(statementExit->expr);
+                generator.pop("rdi");
+                generator.genExit();
+            }
+            void operator()(const node::StatementLet *statementLet) const
+            {
+                generator.genLet(statementLet);
+            }
+            void operator()(const node::Scope *scope) const
+            {
+                generator.genScope(scope);
+            }
+            void operator()(const node::StatementIf *statementIf) const
+            {
+                generator.genIf(statementIf);
+                generator.m_Output << "    ;;/if\n";
+            }
+
+            void operator()(const node::StatementAssignment *statementAssign) const
+            {
+                generator.genAssignment(statementAssign);
+            }
+            void operator()(const node::StatementWhile *statementWhile) const
+            {
+                generator.genLoop(statementWhile->expr, statementWhile->scope, nullptr);
+                generator.m_Output << "    ;;/while\n";
+            }
+            void operator()(const node::StatementFor *statementFor) const
+            {
+                generator.genFor(statementFor);
+                generator.m_Output << "    ;;/for\n";
+            }
+            void operator()(const node::StatementReturn *statementReturn) const
+            {
+                generator.genReturn(statementReturn);
+            }
+            void operator()(const node::StatementCall *statementCall) const
+            {
+                generator.genCall(statementCall->call);
+                generator.pop("rax"); // the result is discarded
+            }
+            void operator()(const node::StatementArray *statementArray) const
+            {
+                generator.genArray(statementArray);
             }
         };
 
         StatementVisitor visitor{.generator = *this};
         // if statement.variant is exit it calls the overloaded operator with StatementExit params, or if it's StatementLet it calls the overloaded operator with StatementLet
         std::visit(visitor, statement->variant);
+        // the code after a nested statement (a loop test, the end of an if) belongs to this one again
+        if (m_Line != statement->line)
+            genLine(statement->line);
     }
 
-    std::string genProg()
+    void genLet(const node::StatementLet *statementLet)
+    {
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable& var){return var.name == statementLet->ident.value.value();});
+        // encounter with let statement, first need to check to make sure that there is not a variable declared with that name
+        if (itr != m_Variables.cend())
+        {
+            std::cerr << "Error :  Redeclaration of variable : " << statementLet->ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        // inside a loop body the slot was reserved in front of the loop, store into it instead of pushing
+        if (const auto reserved = m_Reserved.find(statementLet); reserved != m_Reserved.end())
+        {
+            m_Variables.push_back({.name = statementLet->ident.value.value(), .stackPtr = reserved->second, .reserved = true});
+            if (m_Hoisted.contains(statementLet))
+                return;
+            if (m_Liveness.deadStores.contains(statementLet))
+                return checkStore({}, statementLet->expr);
+            genExpr(statementLet->expr);
+            pop("rax");
+            m_Output << "    MOV " << slot(reserved->second) << ", rax\n";
+            return;
+        }
+        // the slot of a variable that is dead by now, it stays owned by that one
+        if (const auto donor = m_Liveness.slotDonors.find(statementLet); donor != m_Liveness.slotDonors.end())
+        {
+            const size_t stackPtr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                                         { return var.name == donor->second; })
+                                        ->stackPtr;
+            m_Variables.push_back({.name = statementLet->ident.value.value(), .stackPtr = stackPtr, .reserved = true});
+            if (m_Liveness.deadStores.contains(statementLet))
+                return checkStore({}, statementLet->expr);
+            genExpr(statementLet->expr);
+            pop("rax");
+            m_Output << "    MOV " << slot(stackPtr) << ", rax\n";
+            return;
+        }
+        // the value is never read, the variable only needs its slot for the stores after it
+        if (m_Liveness.deadStores.contains(statementLet))
+        {
+            checkStore({}, statementLet->expr);
+            m_Variables.push_back({.name = statementLet->ident.value.value(), .stackPtr = m_StackPtr});
+            m_Output << "    SUB rsp, 8\n";
+            m_StackPtr++;
+            return;
+        }
+        // copy the value of the stack at stack_ptr and push it on the top of the stack and then
+        // when exit is called simply pop it from the stack.
+        m_Variables.push_back({.name = statementLet->ident.value.value(), .stackPtr = m_StackPtr});
+        // evaluate the expression
+        genExpr(statementLet->expr); // now the value of the expression is on the top of the stack
+    }
+
+    void genAssignment(const node::StatementAssignment *statementAssign)
+    {
+        // in order to assing a variable, first check if it exist in the Variable vector
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                              { return var.name == statementAssign->ident.value.value(); });
+        if (itr == m_Variables.end())
+        {
+            std::cerr << "Error : Undeclared Identifier" << statementAssign->ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (m_Liveness.deadStores.contains(statementAssign))
+            return checkStore(*itr, statementAssign->expr);
+
+        if (statementAssign->index)
+            return genElementStore(*itr, statementAssign->index, statementAssign->expr);
+        if (itr->length)
+            return genElementwise(*itr, statementAssign->expr);
+
+        if (genUpdate(*itr, statementAssign->expr))
+            return;
+        // not checking for type, everything is int for now
+        genExpr(statementAssign->expr);
+        pop("rax"); // put the result of the above expr to the rax
+        m_Output << "    MOV " << location(*itr) << ", rax\n";
+    }
+
+    // x = x + leaf, x = leaf + x, x = x - leaf and x = 0 - x update the variable where it is
+    bool genUpdate(const Variable &var, const node::Expr *expr)
+    {
+        const auto exprs = std::get_if<node::Exprs *>(&node::stripParenthesis(expr)->variant);
+        if (!exprs)
+            return false;
+        const auto isTarget = [&](const node::Expr *operand)
+        {
+            const node::Term *term = node::asTerm(operand);
+            const auto termIdent = term ? std::get_if<node::TermIdent *>(&term->variant) : nullptr;
+            return termIdent && (*termIdent)->ident.value.value() == var.name;
+        };
+        const std::string dst = location(var);
+        const node::Expr *other = nullptr;
+        std::string op;
+        if (const auto add = std::get_if<node::ExprsAdd *>(&(*exprs)->variant))
+        {
+            other = isTarget((*add)->lhs) ? (*add)->rhs : isTarget((*add)->rhs) ? (*add)->lhs : nullptr;
+            op = "ADD";
+        }
+        else if (const auto sub = std::get_if<node::ExprsSub *>(&(*exprs)->variant))
+        {
+            if (node::asLiteral((*sub)->lhs) == 0u && isTarget((*sub)->rhs))
+            {
+                m_Output << "    NEG " << dst << "\n";
+                return true;
+            }
+            other = isTarget((*sub)->lhs) ? (*sub)->rhs : nullptr;
+            op = "SUB";
+        }
+        if (!other || !isOperand(other))
+            return false;
+
+        const std::string src = operand(other);
+        if (src == "1")
+            m_Output << "    " << (op == "ADD" ? "INC " : "DEC ") << dst << "\n";
+        else if (!isRegister(dst) && !isRegister(src) && !std::isdigit(src.front()))
+        {
+            // no memory to memory form
+            m_Output << "    MOV rax, " << src << "\n";
+            m_Output << "    " << op << " " << dst << ", rax\n";
+        }
+        else
+            m_Output << "    " << op << " " << dst << ", " << src << "\n";
+        return true;
+    }
+
+    // address of a byte offset into an array, index is a register term added to it, like "rcx + "
+    std::string arrayAddress(const Variable &var, const size_t offset, const std::string &index = "") const
+    {
+        return "[rsp + " + index + std::to_string((m_StackPtr - var.stackPtr - 1) * 8 + offset) + "]";
+    }
+
+    size_t vectorBytes() const
+    {
+        return m_Options.avx2 ? 32 : 16;
+    }
+
+    std::string vectorRegister(const size_t n) const
+    {
+        return (m_Options.avx2 ? "ymm" : "xmm") + std::to_string(n);
+    }
+
+    // dst = dst OP src, in the two operand SSE2 form or the three operand AVX2 form
+    void genVectorOp(const std::string &opr, const std::string &dst, const std::string &src)
+    {
+        if (m_Options.avx2)
+            m_Output << "    V" << opr << " " << dst << ", " << dst << ", " << src << "\n";
+        else
+            m_Output << "    " << opr << " " << dst << ", " << src << "\n";
+    }
+
+    // the array storage is vector aligned, so every load and store is an aligned one
+    void genVectorMove(const std::string &dst, const std::string &src)
+    {
+        m_Output << "    " << (m_Options.avx2 ? "VMOVDQA " : "MOVDQA ") << dst << ", " << src << "\n";
+    }
+
+    // the variable an identifier refers to, it has to be declared
+    const Variable &variable(const Token &ident) const
+    {
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                              { return var.name == ident.value.value(); });
+        if (itr == m_Variables.end())
+        {
+            std::cerr << "Error : Undeclared Identifier : " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return *itr;
+    }
+
+    // a variable read as a value, an array only is one in element-wise code, where it stands for the current element
+    const Variable &valueVariable(const Token &ident) const
     {
+        const Variable &var = variable(ident);
+        if (var.length && !m_Element.has_value())
+        {
+            std::cerr << "Error : Array used as a value : " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return var;
+    }
+
+    Variable arrayVariable(const Token &ident) const
+    {
+        const Variable &var = variable(ident);
+        if (!var.length)
+        {
+            std::cerr << "Error : Not an array : " << ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return var;
+    }
 
+    static void checkIndex(const Variable &var, const uint64_t index)
+    {
+        if (index >= var.length)
+        {
+            std::cerr << "Error : Index " << index << " is out of bounds of " << var.name << "[" << var.length << "]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // an index past the end traps, like a division by 0 does
+    void genBoundsCheck(const Variable &var, const std::string &reg)
+    {
+        m_Output << "    CMP " << reg << ", " << var.length << "\n";
+        m_Output << "    JAE blue_out_of_bounds\n";
+        m_BoundsCheck = true;
+    }
+
+    // the index is already on the stack, unless it is a literal
+    void genElementLoad(const node::TermIndex *termIndex)
+    {
+        const Variable var = arrayVariable(termIndex->ident);
+        if (const auto index = node::asLiteral(termIndex->index))
+        {
+            checkIndex(var, *index);
+            push(slot(var.stackPtr, *index * 8));
+            return;
+        }
+        pop("rax");
+        genBoundsCheck(var, "rax");
+        m_Output << "    MOV rax, QWORD " << arrayAddress(var, 0, "rax * 8 + ") << "\n";
+        push("rax");
+    }
+
+    void genElementStore(const Variable var, const node::Expr *index, const node::Expr *expr)
+    {
+        if (!var.length)
+        {
+            std::cerr << "Error : Not an array : " << var.name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        genExpr(expr);
+        if (const auto literal = node::asLiteral(index))
+        {
+            checkIndex(var, *literal);
+            pop("rax");
+            m_Output << "    MOV " << slot(var.stackPtr, *literal * 8) << ", rax\n";
+            return;
+        }
+        genExpr(index);
+        pop("rbx");
+        pop("rax");
+        genBoundsCheck(var, "rbx");
+        m_Output << "    MOV QWORD " << arrayAddress(var, 0, "rbx * 8 + ") << ", rax\n";
+    }
+
+    // element-wise operations, mul has no 64 bit vector instruction in SSE2/AVX2 and is built from PMULUDQ
+    struct ElementwiseOp
+    {
+        const node::Expr *lhs, *rhs;
+        std::string vector; // empty for mul
+    };
+
+    static std::optional<ElementwiseOp> asElementwiseOp(const node::Exprs *exprs)
+    {
+        if (const auto add = std::get_if<node::ExprsAdd *>(&exprs->variant))
+            return ElementwiseOp{(*add)->lhs, (*add)->rhs, "PADDQ"};
+        if (const auto sub = std::get_if<node::ExprsSub *>(&exprs->variant))
+            return ElementwiseOp{(*sub)->lhs, (*sub)->rhs, "PSUBQ"};
+        if (const auto mul = std::get_if<node::ExprsMul *>(&exprs->variant))
+            return ElementwiseOp{(*mul)->lhs, (*mul)->rhs, ""};
+        return {};
+    }
+
+    // the operands of an element-wise expression are arrays of the target's length, and scalar
+    // variables and literals which are broadcast to every element
+    void checkElementwise(const node::Expr *expr, const size_t length) const
+    {
+        node::walkExpr(expr, [&](const ExprNode &node)
+                       {
+            if (const auto exprs = std::get_if<const node::Exprs *>(&node))
+            {
+                if (asElementwiseOp(*exprs).has_value())
+                    return true;
+            }
+            else if (const node::Term *term = std::get<const node::Term *>(node); std::holds_alternative<node::TermParenthesis *>(term->variant) || std::holds_alternative<node::TermIntLit *>(term->variant))
+                return true;
+            else if (const auto termIdent = std::get_if<node::TermIdent *>(&term->variant))
+            {
+                const Variable &var = variable((*termIdent)->ident);
+                if (var.length && var.length != length)
+                {
+                    std::cerr << "Error : Array " << var.name << "[" << var.length << "] used in an element-wise expression of length " << length << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                return true;
+            }
+            std::cerr << "Error : Element-wise expressions only take arrays, variables and literals with + - *" << std::endl;
+            exit(EXIT_FAILURE); });
+    }
+
+    // nullptr for a scalar variable or a literal
+    const Variable *asArray(const node::Term *term) const
+    {
+        const auto termIdent = std::get_if<node::TermIdent *>(&term->variant);
+        if (!termIdent)
+            return nullptr;
+        const auto itr = std::ranges::find_if(m_Variables, [&](const Variable &var)
+                                              { return var.name == (*termIdent)->ident.value.value(); });
+        return itr->length ? &*itr : nullptr;
+    }
+
+    // registers genVector needs on top of the one it evaluates into, a term operand on the right is used in place
+    static size_t vectorTemporaries(const node::Expr *expr)
+    {
+        // post-order over the operators, each one pops the counts of its operands
+        std::vector<std::pair<const node::Expr *, bool>> nodes{{expr, false}};
+        std::vector<size_t> counts;
+        while (!nodes.empty())
+        {
+            const auto [node, finish] = nodes.back();
+            nodes.pop_back();
+            if (node::asTerm(node))
+            {
+                counts.push_back(0);
+                continue;
+            }
+            const ElementwiseOp op = asElementwiseOp(std::get<node::Exprs *>(node::stripParenthesis(node)->variant)).value();
+            if (!finish)
+            {
+                nodes.push_back({node, true});
+                nodes.push_back({op.rhs, false});
+                nodes.push_back({op.lhs, false});
+                continue;
+            }
+            const size_t rhsCount = counts.back();
+            counts.pop_back();
+            const size_t lhsCount = counts.back();
+            counts.pop_back();
+            const size_t rhs = node::asTerm(op.rhs) ? 0 : 1 + rhsCount;
+            counts.push_back(std::max({lhsCount, rhs, op.vector.empty() ? rhs + 2 : size_t{0}}));
+        }
+        return counts.back();
+    }
+
+    void collectBroadcasts(const node::Expr *expr, std::map<const node::Term *, std::string> &broadcasts)
+    {
+        node::walkExpr(expr, [&](const ExprNode &node)
+                       {
+            const auto term = std::get_if<const node::Term *>(&node);
+            if (term && !std::holds_alternative<node::TermParenthesis *>((*term)->variant) && !asArray(*term))
+                broadcasts.emplace(*term, vectorRegister(15 - broadcasts.size()));
+            return true; });
+    }
+
+    // the vector at byte offset `offset` (+ index) of an array, or the register a scalar is broadcast to
+    std::string vectorOperand(const node::Term *term, const size_t offset, const std::string &index,
+                              const std::map<const node::Term *, std::string> &broadcasts) const
+    {
+        if (const Variable *var = asArray(term))
+            return arrayAddress(*var, offset, index);
+        return broadcasts.at(term);
+    }
+
+    // evaluates one vector of the expression into register 0, an operator leaves its result in the
+    // register its left operand went to and its right operand goes to the next free one
+    void genVector(const node::Expr *expr, const size_t offset, const std::string &index,
+                   const std::map<const node::Term *, std::string> &broadcasts)
+    {
+        struct VectorTask
+        {
+            const node::Expr *expr;
+            size_t n;
+            bool finish;
+        };
+        std::vector<VectorTask> tasks{{expr, 0, false}};
+        while (!tasks.empty())
+        {
+            const VectorTask task = tasks.back();
+            tasks.pop_back();
+            const size_t n = task.n;
+            if (const node::Term *term = node::asTerm(task.expr))
+            {
+                genVectorMove(vectorRegister(n), vectorOperand(term, offset, index, broadcasts));
+                continue;
+            }
+
+            const ElementwiseOp op = asElementwiseOp(std::get<node::Exprs *>(node::stripParenthesis(task.expr)->variant)).value();
+            const node::Term *rhsTerm = node::asTerm(op.rhs);
+            if (!task.finish)
+            {
+                tasks.push_back({task.expr, n, true});
+                if (!rhsTerm)
+                    tasks.push_back({op.rhs, n + 1, false});
+                tasks.push_back({op.lhs, n, false});
+                continue;
+            }
+            const size_t next = rhsTerm ? n + 1 : n + 2;
+            const std::string rhs = rhsTerm ? vectorOperand(rhsTerm, offset, index, broadcasts) : vectorRegister(n + 1);
+            if (!op.vector.empty())
+            {
+                genVectorOp(op.vector, vectorRegister(n), rhs);
+                continue;
+            }
+
+            // lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32), the low 64 bits of the product
+            const std::string a = vectorRegister(n), cross = vectorRegister(next), temp = vectorRegister(next + 1);
+            genVectorMove(cross, a);
+            genVectorOp("PSRLQ", cross, "32");
+            genVectorOp("PMULUDQ", cross, rhs);
+            genVectorMove(temp, rhs);
+            genVectorOp("PSRLQ", temp, "32");
+            genVectorOp("PMULUDQ", temp, a);
+            genVectorOp("PADDQ", cross, temp);
+            genVectorOp("PSLLQ", cross, "32");
+            genVectorOp("PMULUDQ", a, rhs);
+            genVectorOp("PADDQ", a, cross);
+        }
+    }
+
+    // the scalar fallback, pushes element k of the expression
+    void genElement(const node::Expr *expr, const size_t k)
+    {
+        m_Element = k;
+        genExpr(expr);
+        m_Element.reset();
+    }
+
+    // target = expr for every element. whole vectors go through SSE2 (or AVX2), the elements that
+    // don't fill one are done one by one, and so is everything when the expression runs out of registers.
+    // short arrays are unrolled, longer ones loop over the vectors with rcx as the byte offset
+    void genElementwise(const Variable target, const node::Expr *expr)
+    {
+        checkElementwise(expr, target.length);
+        const size_t lanes = vectorBytes() / 8;
+        const size_t vectors = target.length / lanes;
+        std::map<const node::Term *, std::string> broadcasts;
+        collectBroadcasts(expr, broadcasts);
+
+        size_t first = 0; // the first element left to the scalar code
+        if (vectors > 0 && 1 + vectorTemporaries(expr) + broadcasts.size() <= 16)
+        {
+            for (const auto &[term, reg] : broadcasts)
+            {
+                genTerm(term);
+                pop("rax");
+                const std::string xmm = "xmm" + reg.substr(3);
+                if (m_Options.avx2)
+                {
+                    m_Output << "    VMOVQ " << xmm << ", rax\n";
+                    m_Output << "    VPBROADCASTQ " << reg << ", " << xmm << "\n";
+                }
+                else
+                {
+                    m_Output << "    MOVQ " << reg << ", rax\n";
+                    m_Output << "    PUNPCKLQDQ " << reg << ", " << reg << "\n";
+                }
+            }
+
+            if (vectors <= s_UnrollVectors)
+            {
+                for (size_t v = 0; v < vectors; v++)
+                {
+                    genVector(expr, v * vectorBytes(), "", broadcasts);
+                    genVectorMove(arrayAddress(target, v * vectorBytes()), vectorRegister(0));
+                }
+            }
+            else
+            {
+                const std::string loopLabel = createLabel("vector_loop");
+                m_Output << "    XOR rcx, rcx\n";
+                m_Output << loopLabel << ":\n";
+                genVector(expr, 0, "rcx + ", broadcasts);
+                genVectorMove(arrayAddress(target, 0, "rcx + "), vectorRegister(0));
+                m_Output << "    ADD rcx, " << vectorBytes() << "\n";
+                m_Output << "    CMP rcx, " << vectors * vectorBytes() << "\n";
+                m_Output << "    JB " << loopLabel << "\n";
+            }
+            if (m_Options.avx2)
+                m_Output << "    VZEROUPPER\n";
+            first = vectors * lanes;
+        }
+
+        for (size_t k = first; k < target.length; k++)
+        {
+            genElement(expr, k);
+            pop("rax");
+            m_Output << "    MOV " << slot(target.stackPtr, k * 8) << ", rax\n";
+        }
+    }
+
+    // long arrays are cleared with REP STOSQ, short ones with vector stores
+    void genZero(const Variable &var)
+    {
+        const size_t lanes = vectorBytes() / 8;
+        const size_t vectors = var.length / lanes;
+        if (vectors > s_UnrollVectors)
+        {
+            m_Output << "    LEA rdi, " << arrayAddress(var, 0) << "\n";
+            m_Output << "    MOV rcx, " << var.length << "\n";
+            m_Output << "    XOR rax, rax\n";
+            m_Output << "    REP STOSQ\n";
+            return;
+        }
+        if (vectors > 0)
+        {
+            genVectorOp("PXOR", vectorRegister(0), vectorRegister(0));
+            for (size_t v = 0; v < vectors; v++)
+                genVectorMove(arrayAddress(var, v * vectorBytes()), vectorRegister(0));
+            if (m_Options.avx2)
+                m_Output << "    VZEROUPPER\n";
+        }
+        for (size_t k = vectors * lanes; k < var.length; k++)
+            m_Output << "    MOV " << slot(var.stackPtr, k * 8) << ", 0\n";
+    }
+
+    // element 0 sits at the lowest address, frame base - (stackPtr + 1) * 8, the padding in front of
+    // the array makes that a multiple of the vector size. the frame base is aligned by the prologue
+    static uint64_t arrayLength(const node::StatementArray *statementArray)
+    {
+        const uint64_t length = std::stoull(statementArray->size.value.value());
+        if (length == 0 || length > s_MaxArrayLength)
+        {
+            std::cerr << "Error : Invalid array size : " << statementArray->ident.value.value() << "[" << length << "]" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return length;
+    }
+
+    size_t arrayPadding(const size_t length) const
+    {
+        const size_t lanes = vectorBytes() / 8;
+        return (lanes - (m_StackPtr + length) % lanes) % lanes;
+    }
+
+    void genArray(const node::StatementArray *statementArray)
+    {
+        const std::string &name = statementArray->ident.value.value();
+        if (std::ranges::any_of(m_Variables, [&](const Variable &var) { return var.name == name; }))
+        {
+            std::cerr << "Error :  Redeclaration of variable : " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const uint64_t length = arrayLength(statementArray);
+
+        // inside a loop body the storage was reserved in front of the loop, only the initializer runs
+        const auto reserved = m_ReservedArrays.find(statementArray);
+        const size_t padding = reserved == m_ReservedArrays.end() ? arrayPadding(length) : 0;
+        if (reserved == m_ReservedArrays.end())
+        {
+            m_Output << "    SUB rsp, " << (length + padding) * 8 << "\n";
+            m_StackPtr += length + padding;
+        }
+        m_AlignFrame = true;
+
+        // the array isn't visible to its own initializer
+        const Variable var{.name = name,
+                           .stackPtr = reserved == m_ReservedArrays.end() ? m_StackPtr - 1 : reserved->second,
+                           .reserved = reserved != m_ReservedArrays.end(),
+                           .length = length,
+                           .padding = padding};
+
+        if (statementArray->expr)
+            genElementwise(var, statementArray->expr);
+        else
+            genZero(var);
+        m_Variables.push_back(var);
+    }
+
+    struct LoopInfo
+    {
+        std::vector<const node::StatementLet *> lets; // the lets whose slots are reserved in front of the loop
+        std::vector<const node::StatementArray *> arrays; // the arrays whose storage is reserved there as well
+        std::set<std::string> assigned;              // every variable written inside the loop
+        std::set<std::string> declared;              // every variable declared inside the loop
+    };
+
+    // nested loops reserve the slots of their own bodies, their lets are only recorded as declared
+    void analyzeLoop(const node::Scope *scope, LoopInfo &info, const bool reserve)
+    {
+        for (const node::Statement *statement : scope->statements)
+        {
+            if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+            {
+                info.declared.insert((*statementLet)->ident.value.value());
+                if (reserve)
+                    info.lets.push_back(*statementLet);
+            }
+            else if (const auto assign = std::get_if<node::StatementAssignment *>(&statement->variant))
+                info.assigned.insert((*assign)->ident.value.value());
+            else if (const auto statementArray = std::get_if<node::StatementArray *>(&statement->variant))
+            {
+                info.declared.insert((*statementArray)->ident.value.value());
+                if (reserve)
+                    info.arrays.push_back(*statementArray);
+            }
+            else if (const auto nested = std::get_if<node::Scope *>(&statement->variant))
+                analyzeLoop(*nested, info, reserve);
+            else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            {
+                std::vector<Branch> branches{{.expr = (*statementIf)->expr, .scope = (*statementIf)->scope}};
+                if ((*statementIf)->conditionalBr.has_value())
+                    node::collectBranches((*statementIf)->conditionalBr.value(), branches);
+                for (const Branch &branch : branches)
+                    analyzeLoop(branch.scope, info, reserve);
+            }
+            else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+                analyzeLoop((*statementWhile)->scope, info, false);
+            else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+            {
+                info.declared.insert((*statementFor)->init->ident.value.value());
+                info.assigned.insert((*statementFor)->step->ident.value.value());
+                analyzeLoop((*statementFor)->scope, info, false);
+            }
+        }
+    }
+
+    // the test sits at the bottom of the loop, so each iteration runs a single conditional jump.
+    // the slots of the lets in the body are reserved once in front of the loop, so the body doesn't
+    // grow and shrink the stack on every iteration, and the invariant ones are evaluated there as well
+    void genLoop(const node::Expr *expr, const node::Scope *scope, const node::StatementAssignment *step)
+    {
+        LoopInfo info;
+        analyzeLoop(scope, info, true);
+        if (step)
+            info.assigned.insert(step->ident.value.value());
+
+        // each array is padded so element 0 stays vector aligned, as genArray does
+        const size_t stackPtr = m_StackPtr;
+        for (const node::StatementLet *statementLet : info.lets)
+            m_Reserved[statementLet] = m_StackPtr++;
+        for (const node::StatementArray *statementArray : info.arrays)
+        {
+            const uint64_t length = arrayLength(statementArray);
+            m_StackPtr += length + arrayPadding(length);
+            m_ReservedArrays[statementArray] = m_StackPtr - 1;
+        }
+        const size_t reserveCount = m_StackPtr - stackPtr;
+        if (reserveCount > 0)
+            m_Output << "    SUB rsp, " << reserveCount * 8 << "\n";
+
+        for (const node::StatementLet *statementLet : info.lets)
+        {
+            std::set<std::string> idents;
+            liveness::collectIdents(statementLet->expr, idents);
+            const bool invariant = std::ranges::none_of(idents, [&](const std::string &ident)
+                                                        { return info.assigned.contains(ident) || info.declared.contains(ident); });
+            if (!invariant || info.assigned.contains(statementLet->ident.value.value()) || !liveness::isSpeculatable(statementLet->expr) ||
+                m_Liveness.deadStores.contains(statementLet))
+                continue;
+            genExpr(statementLet->expr);
+            pop("rax");
+            m_Output << "    MOV " << slot(m_Reserved[statementLet]) << ", rax\n";
+            m_Hoisted.insert(statementLet);
+        }
+
+        const std::string bodyLabel = createLabel("loop_body");
+        const std::string testLabel = createLabel("loop_test");
+        m_Output << "    JMP " << testLabel << "\n";
+        m_Output << bodyLabel << ":\n";
+        genScope(scope);
+        if (step)
+            genAssignment(step);
+        m_Output << testLabel << ":\n";
+        genBranch(expr, bodyLabel, true);
+
+        if (reserveCount > 0)
+        {
+            m_Output << "    ADD rsp, " << reserveCount * 8 << "\n";
+            m_StackPtr -= reserveCount;
+        }
+        for (const node::StatementLet *statementLet : info.lets)
+        {
+            m_Reserved.erase(statementLet);
+            m_Hoisted.erase(statementLet);
+        }
+        for (const node::StatementArray *statementArray : info.arrays)
+            m_ReservedArrays.erase(statementArray);
+    }
+
+    // the induction variable of a for loop is kept in a callee saved register while there is one free
+    void genFor(const node::StatementFor *statementFor)
+    {
+        const node::StatementLet *init = statementFor->init;
+        beginScope();
+        const bool inRegister = m_LoopRegisters < std::size(s_LoopRegisters);
+        if (inRegister)
+        {
+            if (std::ranges::any_of(m_Variables, [&](const Variable &var)
+                                    { return var.name == init->ident.value.value(); }))
+            {
+                std::cerr << "Error :  Redeclaration of variable : " << init->ident.value.value() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            const std::string reg = s_LoopRegisters[m_LoopRegisters++];
+            m_MaxLoopRegisters = std::max(m_MaxLoopRegisters, m_LoopRegisters);
+            genExpr(init->expr);
+            pop(reg);
+            m_Variables.push_back({.name = init->ident.value.value(), .stackPtr = m_StackPtr, .reg = reg});
+        }
+        else
+        {
+            genLet(init);
+        }
+
+        genLoop(statementFor->expr, statementFor->scope, statementFor->step);
+        endScope();
+        if (inRegister)
+            m_LoopRegisters--;
+    }
+
+    static void collectCalls(const node::Expr *expr, std::vector<const node::TermCall *> &calls)
+    {
+        node::walkExpr(expr, [&](const ExprNode &node)
+                       {
+            const auto term = std::get_if<const node::Term *>(&node);
+            if (const auto termCall = term ? std::get_if<node::TermCall *>(&(*term)->variant) : nullptr)
+                calls.push_back(*termCall);
+            return true; });
+    }
+
+    // returns the number of statements in the scope, nested ones included
+    static size_t collectCalls(const node::Scope *scope, std::vector<const node::TermCall *> &calls)
+    {
+        size_t count = 0;
+        for (const node::Statement *statement : scope->statements)
+        {
+            count++;
+            if (const auto statementExit = std::get_if<node::StatementExit *>(&statement->variant))
+                collectCalls((*statementExit)->expr, calls);
+            else if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+                collectCalls((*statementLet)->expr, calls);
+            else if (const auto nested = std::get_if<node::Scope *>(&statement->variant))
+                count += collectCalls(*nested, calls);
+            else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            {
+                std::vector<Branch> branches{{.expr = (*statementIf)->expr, .scope = (*statementIf)->scope}};
+                if ((*statementIf)->conditionalBr.has_value())
+                    node::collectBranches((*statementIf)->conditionalBr.value(), branches);
+                for (const Branch &branch : branches)
+                {
+                    if (branch.expr)
+                        collectCalls(branch.expr, calls);
+                    count += collectCalls(branch.scope, calls);
+                }
+            }
+            else if (const auto assign = std::get_if<node::StatementAssignment *>(&statement->variant))
+            {
+                collectCalls((*assign)->expr, calls);
+                if ((*assign)->index)
+                    collectCalls((*assign)->index, calls);
+            }
+            else if (const auto statementArray = std::get_if<node::StatementArray *>(&statement->variant))
+            {
+                if ((*statementArray)->expr)
+                    collectCalls((*statementArray)->expr, calls);
+            }
+            else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+            {
+                collectCalls((*statementWhile)->expr, calls);
+                count += collectCalls((*statementWhile)->scope, calls);
+            }
+            else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+            {
+                collectCalls((*statementFor)->init->expr, calls);
+                collectCalls((*statementFor)->expr, calls);
+                collectCalls((*statementFor)->step->expr, calls);
+                count += collectCalls((*statementFor)->scope, calls);
+            }
+            else if (const auto statementReturn = std::get_if<node::StatementReturn *>(&statement->variant))
+                collectCalls((*statementReturn)->expr, calls);
+            else if (const auto statementCall = std::get_if<node::StatementCall *>(&statement->variant))
+            {
+                calls.push_back((*statementCall)->call);
+                for (const node::Expr *arg : (*statementCall)->call->args)
+                    collectCalls(arg, calls);
+            }
+        }
+        return count;
+    }
+
+    // walks the call graph bottom up: a function is inlined when all of its callees are inlined as well
+    // and its size, with the inlined callees counted at every call site, stays under s_InlineLimit.
+    // recursive functions never qualify
+    void findInlineFunctions()
+    {
+        std::map<std::string, std::pair<size_t, std::vector<const node::TermCall *>>> bodies;
+        for (const auto &[name, function] : m_Functions)
+        {
+            // an imported function has no body here
+            if (!function->scope)
+                continue;
+            std::vector<const node::TermCall *> calls;
+            const size_t count = collectCalls(function->scope, calls);
+            bodies[name] = {count, calls};
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (const auto &[name, body] : bodies)
+                if (!m_Inline.contains(name) && tryInline(name, body.first, body.second))
+                    changed = true;
+        }
+    }
+
+    // inlines the function when its callees are all inlined and it stays under s_InlineLimit with them
+    bool tryInline(const std::string &name, size_t size, const std::vector<const node::TermCall *> &calls)
+    {
+        for (const node::TermCall *call : calls)
+        {
+            const std::string &callee = call->ident.value.value();
+            if (!m_Inline.contains(callee))
+                return false;
+            size += m_InlineSizes[callee];
+        }
+        if (size > s_InlineLimit)
+            return false;
+        m_Inline.insert(name);
+        m_InlineSizes[name] = size;
+        return true;
+    }
+
+    // the arguments are evaluated left to right on the stack, then moved to their registers
+    const node::Function *checkCall(const node::TermCall *call) const
+    {
+        const std::string &name = call->ident.value.value();
+        const auto itr = m_Functions.find(name);
+        if (itr == m_Functions.end())
+        {
+            std::cerr << "Error : Undeclared function : " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const node::Function *function = itr->second;
+        if (call->args.size() != function->params.size())
+        {
+            std::cerr << "Error : Function " << name << " expects " << function->params.size() << " arguments, got " << call->args.size() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return function;
+    }
+
+    void genCall(const node::TermCall *call)
+    {
+        checkCall(call);
+        for (const node::Expr *arg : call->args)
+            genExpr(arg);
+        genCallSite(call);
+    }
+
+    // the arguments are on the stack, the last one on top
+    void genCallSite(const node::TermCall *call)
+    {
+        const std::string &name = call->ident.value.value();
+        if (m_Inline.contains(name))
+        {
+            genInline(m_Functions.at(name));
+            return;
+        }
+        for (size_t i = call->args.size(); i > 0; i--)
+            pop(s_ArgRegisters[i - 1]);
+        m_Output << "    CALL fn_" << name << "\n";
+        push("rax");
+    }
+
+    // the arguments already sit on the stack, they become the slots of the parameters
+    void genInline(const node::Function *function)
+    {
+        const size_t base = m_StackPtr - function->params.size();
+        const int line = m_Line;
+        Frame caller = enterFrame(m_StackPtr, {.returnLabel = createLabel("inline_return"), .base = base, .inlined = true});
+        for (size_t i = 0; i < function->params.size(); i++)
+            m_Variables.push_back({.name = function->params[i].value.value(), .stackPtr = base + i});
+
+        m_Output << "    ;;inline " << function->ident.value.value() << "\n";
+        genScope(function->scope);
+        // falling off the end returns 0
+        m_Output << "    MOV rax, 0\n";
+        if (!function->params.empty())
+            m_Output << "    ADD rsp, " << function->params.size() * 8 << "\n";
+        m_Output << m_Function->returnLabel << ":\n";
+
+        leaveFrame(caller);
+        m_StackPtr = base;
+        if (m_Line != line)
+            genLine(line);
+        push("rax");
+    }
+
+    void genReturn(const node::StatementReturn *statementReturn)
+    {
+        if (!m_Function.has_value())
+        {
+            std::cerr << "Error : return outside of a function" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        genExpr(statementReturn->expr);
+        pop("rax");
+        // a called function restores rsp from rbp in its epilogue, an inlined one has to drop its own slots
+        if (m_Function->inlined && m_StackPtr > m_Function->base)
+            m_Output << "    ADD rsp, " << (m_StackPtr - m_Function->base) * 8 << "\n";
+        m_Output << "    JMP " << m_Function->returnLabel << "\n";
+    }
+
+    // rbp based frame: the parameters are spilled to the stack on entry, and the callee saved
+    // registers used by for loops are preserved. the body is generated first so we know which ones
+    void genFunction(const node::Function *function)
+    {
+        if (function->params.size() > std::size(s_ArgRegisters))
+        {
+            std::cerr << "Error : Function " << function->ident.value.value() << " takes more than " << std::size(s_ArgRegisters) << " parameters" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        genLine(function->ident.line);
+        Frame caller = enterFrame(0, {.returnLabel = createLabel("return"), .base = 0, .inlined = false});
+        const size_t loopRegisters = m_LoopRegisters;
+        const size_t maxLoopRegisters = m_MaxLoopRegisters;
+        const bool alignFrame = m_AlignFrame;
+        m_LoopRegisters = 0;
+        m_MaxLoopRegisters = 0;
+        m_AlignFrame = false;
+        std::stringstream body;
+        m_Output.swap(body);
+
+        for (size_t i = 0; i < function->params.size(); i++)
+        {
+            const std::string &param = function->params[i].value.value();
+            if (std::ranges::any_of(m_Variables, [&](const Variable &var) { return var.name == param; }))
+            {
+                std::cerr << "Error :  Redeclaration of variable : " << param << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            m_Variables.push_back({.name = param, .stackPtr = m_StackPtr});
+            push(s_ArgRegisters[i]);
+        }
+        genScope(function->scope);
+        m_Output << "    MOV rax, 0\n";
+
+        m_Output.swap(body);
+        m_Output << "fn_" << function->ident.value.value() << ":\n";
+        m_Output << "    PUSH rbp\n";
+        m_Output << "    MOV rbp, rsp\n";
+        for (size_t i = 0; i < m_MaxLoopRegisters; i++)
+            m_Output << "    PUSH " << s_LoopRegisters[i] << "\n";
+        // the callers don't keep rsp aligned, the epilogue restores it from rbp anyway
+        if (m_AlignFrame)
+            m_Output << "    AND rsp, -" << vectorBytes() << "\n";
+        m_Output << body.str();
+        m_Output << m_Function->returnLabel << ":\n";
+        m_Output << "    LEA rsp, [rbp - " << m_MaxLoopRegisters * 8 << "]\n";
+        for (size_t i = m_MaxLoopRegisters; i > 0; i--)
+            m_Output << "    POP " << s_LoopRegisters[i - 1] << "\n";
+        m_Output << "    POP rbp\n";
+        m_Output << "    RET\n";
+
+        m_LoopRegisters = loopRegisters;
+        m_MaxLoopRegisters = maxLoopRegisters;
+        m_AlignFrame = alignFrame;
+        leaveFrame(caller);
+    }
+
+    // the whole program was evaluated at compile time, all that's left is its exit code
+    static std::string genConstantProg(const uint64_t code)
+    {
+        return "global _start\n_start:\n    MOV rdi, " + std::to_string(code) + "\n    MOV rax, 60\n    syscall\n";
+    }
+
+    void registerFunction(const node::Function *function)
+    {
+        if (!m_Functions.emplace(function->ident.value.value(), function).second)
+        {
+            std::cerr << "Error : Redeclaration of function : " << function->ident.value.value() << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // a function of another module, only its signature is known
+    void importFunction(const node::Function *function)
+    {
+        registerFunction(&m_Signatures.emplace_back(node::Function{.ident = function->ident, .params = function->params}));
+        m_Imports.push_back(function->ident.value.value());
+    }
+
+    void flushStream()
+    {
+        *m_Stream << Peephole(m_Output.str()).optimize();
+        m_Output.str("");
+        if (!m_Data.str().empty())
+        {
+            *m_Stream << "section .rodata\n" << m_Data.str() << "section .text\n";
+            m_Data.str("");
+        }
+    }
+
+    // the marks of a streamed item, they are keyed by the addresses of its nodes
+    void addLiveness(const Liveness &liveness)
+    {
+        m_Liveness.deadStores.insert(liveness.deadStores.begin(), liveness.deadStores.end());
+        m_Liveness.slotDonors.insert(liveness.slotDonors.begin(), liveness.slotDonors.end());
+    }
+
+    void removeLiveness(const Liveness &liveness)
+    {
+        for (const void *store : liveness.deadStores)
+            m_Liveness.deadStores.erase(store);
+        for (const auto &[statementLet, donor] : liveness.slotDonors)
+            m_Liveness.slotDonors.erase(statementLet);
+    }
+
+    // statement at a time compilation: every top level statement is generated and written out as soon
+    // as it is parsed, so its nodes can be released before the next one is parsed. the peephole pass
+    // only sees one statement at a time, a function has to be declared before it is called and
+    // profile guided builds aren't supported
+    void beginStream(std::ostream &output)
+    {
+        m_Stream = &output;
         m_Output << "global _start\n_start:\n";
+        // we don't know yet whether there are any arrays
+        if (vectorBytes() > 16)
+            m_Output << "    AND rsp, -" << vectorBytes() << "\n";
+        flushStream();
+    }
+
+    // returns true when the function is inlined, its nodes have to be kept for the call sites then.
+    // the others are written out right away, in a section of their own so the code of _start stays contiguous
+    bool streamFunction(const node::Function *function)
+    {
+        registerFunction(function);
+        Liveness analyzed;
+        liveness::analyzeFrame(function->scope->statements, {}, analyzed);
+        addLiveness(analyzed);
+        std::vector<const node::TermCall *> calls;
+        const size_t size = collectCalls(function->scope, calls);
+        if (tryInline(function->ident.value.value(), size, calls))
+            return true;
+
+        m_Output << "section .text.fn progbits alloc exec nowrite align=16\n";
+        genFunction(function);
+        m_Output << "section .text\n";
+        flushStream();
+        // its nodes are released, the statements parsed next can get their addresses
+        removeLiveness(analyzed);
+        m_Functions[function->ident.value.value()] = &m_Signatures.emplace_back(node::Function{.ident = function->ident, .params = function->params});
+        return false;
+    }
+
+    // the statements after the current one aren't known yet, so every variable in scope counts as
+    // read later and the slots of the top level ones aren't shared
+    void streamStatement(node::Statement *statement)
+    {
+        if (m_Exited)
+            return checkUnreachable({statement}, 0);
+        std::set<std::string> live;
+        for (const Variable &var : m_Variables)
+            live.insert(var.name);
+        if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+            live.insert((*statementLet)->ident.value.value());
+        Liveness analyzed;
+        liveness::analyzeFrame({statement}, std::move(live), analyzed);
+        addLiveness(analyzed);
+
+        genStatement(statement);
+        flushStream();
+        m_Exited = node::isExit(statement);
 
-        for (const node::Statement *statement : m_Prog.statements)
-            genStatement(statement);
+        // the nodes are released after the statement, only the marks of the inlined functions are kept
+        removeLiveness(analyzed);
+    }
+
+    void endStream()
+    {
+        m_Output << "    MOV rdi, 0\n";
+        genExit();
+        if (m_BoundsCheck)
+            m_Output << "blue_out_of_bounds:\n    UD2\n";
+        flushStream();
+    }
+
+    std::string genProg()
+    {
+        for (const node::Function *function : m_Prog.functions)
+            registerFunction(function);
+        findInlineFunctions();
+        liveness::analyzeFrame(m_Prog.statements, {}, m_Liveness);
+        for (const node::Function *function : m_Prog.functions)
+            liveness::analyzeFrame(function->scope->statements, {}, m_Liveness);
+
+        numberCounters(m_Prog.statements);
+        for (const node::Function *function : m_Prog.functions)
+            numberCounters(function->scope->statements);
+        if (!m_Options.profile.empty())
+        {
+            m_UseProfile = m_Options.profile.size() == m_Counters.size() + 2 &&
+                           m_Options.profile[0] == s_ProfileMagic && m_Options.profile[1] == m_Counters.size();
+            if (!m_UseProfile)
+                std::cerr << "Warning : the profile doesn't match the program, ignoring it" << std::endl;
+        }
+
+        std::stringstream main;
+        m_Output.swap(main);
+        const size_t count = node::reachableCount(m_Prog.statements);
+        for (size_t i = 0; i < count; i++)
+            genStatement(m_Prog.statements[i]);
+        checkUnreachable(m_Prog.statements, count);
 
         // default exit with 0, if there is no exit in the code, it will call the exit syscall by default
-        m_Output << "    MOV rax, 60\n"; // MOV NR value for the exit system call to rax register
         m_Output << "    MOV rdi, 0\n";
-        m_Output << "    syscall\n";
-        return m_Output.str();
+        genExit();
+
+        m_Output.swap(main);
+        for (const std::string &name : m_Imports)
+            m_Output << "extern fn_" << name << "\n";
+        if (m_Options.exports)
+            for (const node::Function *function : m_Prog.functions)
+                m_Output << "global fn_" << function->ident.value.value() << "\n";
+        if (!m_Options.library)
+        {
+            m_Output << "global _start\n_start:\n";
+            // rsp is 16 byte aligned on entry, AVX2 arrays want 32
+            if (m_AlignFrame && vectorBytes() > 16)
+                m_Output << "    AND rsp, -" << vectorBytes() << "\n";
+            m_Output << main.str();
+        }
+
+        // an exported function is emitted even when it's inlined here, the other modules call it
+        for (const node::Function *function : m_Prog.functions)
+            if (m_Options.exports || !m_Inline.contains(function->ident.value.value()))
+                genFunction(function);
+
+        if (m_Options.profileGenerate)
+            genProfileDump();
+        if (m_BoundsCheck)
+            m_Output << "blue_out_of_bounds:\n    UD2\n";
+        m_Output << m_Cold.str();
+
+        if (m_Options.checkOnly)
+            return {};
+        std::string output = Peephole(m_Output.str()).optimize();
+        if (!m_Data.str().empty())
+            output += "section .rodata\n" + m_Data.str();
+        if (m_Options.profileGenerate)
+            output += "section .data\nblue_profile:\n    dq " + std::to_string(s_ProfileMagic) + ", " + std::to_string(m_Counters.size()) +
+                      "\n    times " + std::to_string(m_Counters.size()) + " dq 0\n";
+        return output;
     }
 };
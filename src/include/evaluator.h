@@ -0,0 +1,452 @@
+#pragma once
+
+#include "./node.h"
+#include <map>
+#include <unordered_map>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+// runs a whole program at compile time. a blue program takes no input, so one that finishes within the
+// step budget always exits with the same code, and the binary only has to make the exit syscall.
+// whatever can't be decided ahead of time (a trap, running out of steps, recursing too deep) gives up.
+// the program is expected to have gone through the code generator first, it reports the compile errors
+class Evaluator
+{
+private:
+    const node::Prog &m_Prog;
+    uint64_t m_Steps;
+    std::map<std::string, const node::Function *> m_Functions{};
+
+    static constexpr size_t s_MaxDepth = 1000; // nested calls, deeper recursion is left to the binary
+
+    struct Value
+    {
+        std::vector<uint64_t> elements; // a scalar has one
+        bool array;
+    };
+
+    // the variables of the function being run, a call sets the caller's aside
+    struct Frame
+    {
+        std::unordered_map<std::string, Value> variables;
+        std::vector<std::string> declared; // in declaration order, a scope drops the ones it declared
+    };
+
+    Frame m_Frame{};
+    size_t m_Depth = 0;
+
+    enum class Flow
+    {
+        next,
+        returned,
+        exited,
+        gaveUp,
+    };
+
+    Flow m_Flow = Flow::next;
+    uint64_t m_Value = 0; // the return value or the exit code
+
+    bool step()
+    {
+        if (m_Steps == 0)
+        {
+            m_Flow = Flow::gaveUp;
+            return false;
+        }
+        m_Steps--;
+        return true;
+    }
+
+    std::nullopt_t giveUp()
+    {
+        m_Flow = Flow::gaveUp;
+        return std::nullopt;
+    }
+
+    Value *lookup(const Token &ident)
+    {
+        const auto itr = m_Frame.variables.find(ident.value.value());
+        return itr == m_Frame.variables.end() ? nullptr : &itr->second;
+    }
+
+    void declare(const Token &ident, Value value)
+    {
+        m_Frame.variables[ident.value.value()] = std::move(value);
+        m_Frame.declared.push_back(ident.value.value());
+    }
+
+    using ExprNode = std::variant<const node::Term *, const node::Exprs *>;
+
+    static ExprNode asNode(const node::Expr *expr)
+    {
+        return std::visit([](const auto *node) -> ExprNode
+                          { return node; },
+                          expr->variant);
+    }
+
+    // same order as the generated code: the right operand of a binary operator first, the arguments of a
+    // call left to right. an array stands for its element `element` in an element-wise expression
+    std::optional<uint64_t> eval(const node::Expr *expr, const std::optional<size_t> element = {})
+    {
+        enum class Stage
+        {
+            schedule,
+            finish,
+            shortCircuit, // the left operand of && or || is done
+        };
+        std::vector<std::pair<ExprNode, Stage>> tasks{{asNode(expr), Stage::schedule}};
+        std::vector<uint64_t> values;
+        while (!tasks.empty())
+        {
+            if (!step())
+                return {};
+            const auto [node, stage] = tasks.back();
+            tasks.pop_back();
+
+            if (const auto exprs = std::get_if<const node::Exprs *>(&node))
+            {
+                const bool isAnd = std::holds_alternative<node::ExprsAnd *>((*exprs)->variant);
+                const bool isOr = std::holds_alternative<node::ExprsOr *>((*exprs)->variant);
+                const auto [lhs, rhs] = std::visit([](const auto *opr)
+                                                   { return std::pair{opr->lhs, opr->rhs}; },
+                                                   (*exprs)->variant);
+                if (stage == Stage::schedule)
+                {
+                    if (isAnd || isOr)
+                    {
+                        tasks.push_back({node, Stage::shortCircuit});
+                        tasks.push_back({asNode(lhs), Stage::schedule});
+                        continue;
+                    }
+                    tasks.push_back({node, Stage::finish});
+                    tasks.push_back({asNode(lhs), Stage::schedule});
+                    tasks.push_back({asNode(rhs), Stage::schedule});
+                    continue;
+                }
+                if (stage == Stage::shortCircuit)
+                {
+                    const uint64_t value = values.back();
+                    values.pop_back();
+                    if (isAnd ? value == 0 : value != 0)
+                    {
+                        values.push_back(isOr);
+                        continue;
+                    }
+                    tasks.push_back({node, Stage::finish});
+                    tasks.push_back({asNode(rhs), Stage::schedule});
+                    continue;
+                }
+                if (isAnd || isOr)
+                {
+                    values.back() = values.back() != 0;
+                    continue;
+                }
+
+                const uint64_t l = values.back();
+                values.pop_back();
+                const uint64_t r = values.back();
+                values.pop_back();
+                if (std::holds_alternative<node::ExprsDiv *>((*exprs)->variant) && r == 0)
+                    return giveUp(); // the binary traps
+                values.push_back(std::visit([&](const auto *opr) -> uint64_t
+                                            {
+                    using T = std::remove_cvref_t<decltype(*opr)>;
+                    if constexpr (std::is_same_v<T, node::ExprsAdd>) return l + r;
+                    else if constexpr (std::is_same_v<T, node::ExprsSub>) return l - r;
+                    else if constexpr (std::is_same_v<T, node::ExprsMul>) return l * r;
+                    else if constexpr (std::is_same_v<T, node::ExprsDiv>) return l / r;
+                    else if constexpr (std::is_same_v<T, node::ExprsEq>) return l == r;
+                    else if constexpr (std::is_same_v<T, node::ExprsNotEq>) return l != r;
+                    else if constexpr (std::is_same_v<T, node::ExprsLess>) return l < r;
+                    else if constexpr (std::is_same_v<T, node::ExprsLessEq>) return l <= r;
+                    else if constexpr (std::is_same_v<T, node::ExprsGreater>) return l > r;
+                    else if constexpr (std::is_same_v<T, node::ExprsGreaterEq>) return l >= r;
+                    else return 0; },
+                                            (*exprs)->variant));
+                continue;
+            }
+
+            const node::Term *term = std::get<const node::Term *>(node);
+            if (const auto termIntLit = std::get_if<node::TermIntLit *>(&term->variant))
+                values.push_back(std::stoull((*termIntLit)->int_literal.value.value()));
+            else if (const auto termIdent = std::get_if<node::TermIdent *>(&term->variant))
+            {
+                const Value *value = lookup((*termIdent)->ident);
+                if (!value || (value->array && !element.has_value()))
+                    return giveUp();
+                values.push_back(value->elements[value->array ? element.value() : 0]);
+            }
+            else if (const auto termParenthesis = std::get_if<node::TermParenthesis *>(&term->variant))
+                tasks.push_back({asNode((*termParenthesis)->expr), Stage::schedule});
+            else if (const auto termNot = std::get_if<node::TermNot *>(&term->variant))
+            {
+                if (stage == Stage::finish)
+                {
+                    values.back() = values.back() == 0;
+                    continue;
+                }
+                tasks.push_back({node, Stage::finish});
+                tasks.push_back({(*termNot)->term, Stage::schedule});
+            }
+            else if (const auto termIndex = std::get_if<node::TermIndex *>(&term->variant))
+            {
+                if (stage == Stage::schedule)
+                {
+                    tasks.push_back({node, Stage::finish});
+                    tasks.push_back({asNode((*termIndex)->index), Stage::schedule});
+                    continue;
+                }
+                const Value *value = lookup((*termIndex)->ident);
+                if (!value || !value->array || values.back() >= value->elements.size())
+                    return giveUp();
+                values.back() = value->elements[values.back()];
+            }
+            else if (const auto termCall = std::get_if<node::TermCall *>(&term->variant))
+            {
+                const std::vector<node::Expr *> &args = (*termCall)->args;
+                if (stage == Stage::schedule)
+                {
+                    tasks.push_back({node, Stage::finish});
+                    for (auto arg = args.rbegin(); arg != args.rend(); arg++)
+                        tasks.push_back({asNode(*arg), Stage::schedule});
+                    continue;
+                }
+                std::vector<uint64_t> argValues(values.end() - args.size(), values.end());
+                values.resize(values.size() - args.size());
+                const auto result = call(*termCall, std::move(argValues));
+                if (!result.has_value())
+                    return {};
+                values.push_back(result.value());
+            }
+        }
+        return values.back();
+    }
+
+    std::optional<uint64_t> call(const node::TermCall *termCall, std::vector<uint64_t> args)
+    {
+        const auto itr = m_Functions.find(termCall->ident.value.value());
+        if (itr == m_Functions.end() || itr->second->params.size() != args.size() || m_Depth == s_MaxDepth)
+            return giveUp();
+
+        const node::Function *function = itr->second;
+        Frame caller = std::move(m_Frame);
+        m_Frame = {};
+        m_Depth++;
+        for (size_t i = 0; i < args.size(); i++)
+            declare(function->params[i], {.elements = {args[i]}, .array = false});
+        execScope(function->scope->statements);
+        m_Depth--;
+        m_Frame = std::move(caller);
+
+        // falling off the end returns 0
+        if (m_Flow == Flow::next)
+            return 0;
+        if (m_Flow != Flow::returned)
+            return {};
+        m_Flow = Flow::next;
+        return m_Value;
+    }
+
+    void execScope(const std::vector<node::Statement *> &statements)
+    {
+        const size_t declared = m_Frame.declared.size();
+        for (const node::Statement *statement : statements)
+        {
+            exec(statement);
+            if (m_Flow != Flow::next)
+                break;
+        }
+        while (m_Frame.declared.size() > declared)
+        {
+            m_Frame.variables.erase(m_Frame.declared.back());
+            m_Frame.declared.pop_back();
+        }
+    }
+
+    // `target = expr` as the generated code does it, the value first and the index after it
+    void execAssignment(const node::StatementAssignment *statementAssign)
+    {
+        Value *target = lookup(statementAssign->ident);
+        if (!target)
+        {
+            giveUp();
+            return;
+        }
+        if (statementAssign->index)
+        {
+            const auto value = eval(statementAssign->expr);
+            const auto index = value.has_value() ? eval(statementAssign->index) : std::nullopt;
+            if (!index.has_value())
+                return;
+            // a call in the expressions sets the frame aside and back, look the target up again
+            target = lookup(statementAssign->ident);
+            if (!target->array || index.value() >= target->elements.size())
+            {
+                giveUp();
+                return;
+            }
+            target->elements[index.value()] = value.value();
+            return;
+        }
+        if (!target->array)
+        {
+            if (const auto value = eval(statementAssign->expr))
+                lookup(statementAssign->ident)->elements[0] = value.value();
+            return;
+        }
+        // element-wise, the expression only reads
+        std::vector<uint64_t> elements(target->elements.size());
+        for (size_t k = 0; k < elements.size(); k++)
+        {
+            const auto value = eval(statementAssign->expr, k);
+            if (!value.has_value())
+                return;
+            elements[k] = value.value();
+        }
+        target->elements = std::move(elements);
+    }
+
+    void exec(const node::Statement *statement)
+    {
+        if (!step())
+            return;
+        if (const auto statementExit = std::get_if<node::StatementExit *>(&statement->variant))
+        {
+            if (const auto value = eval((*statementExit)->expr))
+            {
+                m_Value = value.value();
+                m_Flow = Flow::exited;
+            }
+        }
+        else if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+        {
+            if (const auto value = eval((*statementLet)->expr))
+                declare((*statementLet)->ident, {.elements = {value.value()}, .array = false});
+        }
+        else if (const auto statementArray = std::get_if<node::StatementArray *>(&statement->variant))
+        {
+            const uint64_t length = std::stoull((*statementArray)->size.value.value());
+            if (m_Steps < length)
+            {
+                giveUp();
+                return;
+            }
+            m_Steps -= length;
+            // the array isn't visible to its own initializer
+            std::vector<uint64_t> elements(length);
+            for (size_t k = 0; (*statementArray)->expr && k < length; k++)
+            {
+                const auto value = eval((*statementArray)->expr, k);
+                if (!value.has_value())
+                    return;
+                elements[k] = value.value();
+            }
+            declare((*statementArray)->ident, {.elements = std::move(elements), .array = true});
+        }
+        else if (const auto assign = std::get_if<node::StatementAssignment *>(&statement->variant))
+            execAssignment(*assign);
+        else if (const auto scope = std::get_if<node::Scope *>(&statement->variant))
+            execScope((*scope)->statements);
+        else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+        {
+            const auto condition = eval((*statementIf)->expr);
+            if (!condition.has_value())
+                return;
+            if (condition.value() != 0)
+                return execScope((*statementIf)->scope->statements);
+            // the elif arms in order, then the else
+            std::optional<node::ConditionalBranch *> conditionalBr = (*statementIf)->conditionalBr;
+            while (conditionalBr.has_value())
+            {
+                if (const auto conditionalBrElse = std::get_if<node::ConditionalBranchElse *>(&conditionalBr.value()->variant))
+                    return execScope((*conditionalBrElse)->scope->statements);
+                const node::ConditionalBranchElif *conditionalBrElif = std::get<node::ConditionalBranchElif *>(conditionalBr.value()->variant);
+                const auto elifCondition = eval(conditionalBrElif->expr);
+                if (!elifCondition.has_value())
+                    return;
+                if (elifCondition.value() != 0)
+                    return execScope(conditionalBrElif->scope->statements);
+                conditionalBr = conditionalBrElif->conditionalBr;
+            }
+        }
+        else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+        {
+            while (true)
+            {
+                const auto condition = eval((*statementWhile)->expr);
+                if (!condition.has_value() || condition.value() == 0)
+                    return;
+                execScope((*statementWhile)->scope->statements);
+                if (m_Flow != Flow::next)
+                    return;
+            }
+        }
+        else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+        {
+            // the induction variable is scoped to the loop
+            const size_t declared = m_Frame.declared.size();
+            if (const auto init = eval((*statementFor)->init->expr))
+            {
+                declare((*statementFor)->init->ident, {.elements = {init.value()}, .array = false});
+                while (true)
+                {
+                    const auto condition = eval((*statementFor)->expr);
+                    if (!condition.has_value() || condition.value() == 0)
+                        break;
+                    execScope((*statementFor)->scope->statements);
+                    if (m_Flow != Flow::next)
+                        break;
+                    execAssignment((*statementFor)->step);
+                    if (m_Flow != Flow::next)
+                        break;
+                }
+            }
+            while (m_Frame.declared.size() > declared)
+            {
+                m_Frame.variables.erase(m_Frame.declared.back());
+                m_Frame.declared.pop_back();
+            }
+        }
+        else if (const auto statementReturn = std::get_if<node::StatementReturn *>(&statement->variant))
+        {
+            if (const auto value = eval((*statementReturn)->expr))
+            {
+                m_Value = value.value();
+                m_Flow = Flow::returned;
+            }
+        }
+        else if (const auto statementCall = std::get_if<node::StatementCall *>(&statement->variant))
+        {
+            std::vector<uint64_t> args;
+            for (const node::Expr *arg : (*statementCall)->call->args)
+            {
+                const auto value = eval(arg);
+                if (!value.has_value())
+                    return;
+                args.push_back(value.value());
+            }
+            call((*statementCall)->call, std::move(args));
+        }
+    }
+
+public:
+    static constexpr uint64_t s_StepBudget = 10'000'000;
+
+    inline explicit Evaluator(const node::Prog &prog, const uint64_t steps = s_StepBudget) : m_Prog(prog), m_Steps(steps) {}
+
+    // the exit code, nothing when the program has to run to find it out
+    std::optional<uint64_t> run()
+    {
+        for (const node::Function *function : m_Prog.functions)
+            m_Functions.emplace(function->ident.value.value(), function);
+        execScope(m_Prog.statements);
+        if (m_Flow == Flow::exited)
+            return m_Value;
+        // without an exit the program exits with 0
+        if (m_Flow == Flow::next)
+            return 0;
+        return {};
+    }
+};
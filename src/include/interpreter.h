@@ -0,0 +1,154 @@
+#pragma once
+
+#include "./bytecode.h"
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <vector>
+
+// runs the bytecode, with a computed goto per instruction instead of a switch so every handler
+// dispatches the next one itself. a trap kills the process with the signal the native code gets
+class Interpreter
+{
+private:
+    const bytecode::Program &m_Program;
+
+    [[noreturn]] static void trap(const int signal)
+    {
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+        std::_Exit(128 + signal);
+    }
+
+public:
+    inline explicit Interpreter(const bytecode::Program &program) : m_Program(program) {}
+
+    // the exit code of the program
+    uint64_t run() const
+    {
+        // in the order of bytecode::Op
+        static const void *const s_Dispatch[] = {
+            &&loadk, &&mov, &&add, &&sub, &&mul, &&div, &&eq, &&ne, &&lt, &&le, &&gt, &&ge,
+            &&notOp, &&boolOp, &&jmp, &&jz, &&jnz, &&check, &&loade, &&storee, &&zero, &&call, &&ret, &&exit};
+        static_assert(std::size(s_Dispatch) == static_cast<size_t>(bytecode::Op::count));
+
+        // the register windows of the active calls, a callee's window starts at the arguments of its call
+        struct Return
+        {
+            const bytecode::Instruction *pc;
+            size_t base;
+            uint32_t dst;
+        };
+        std::vector<uint64_t> stack(m_Program.frameSize);
+        std::vector<Return> calls;
+        size_t base = 0;
+        uint64_t *r = stack.data();
+        const uint64_t *k = m_Program.constants.data();
+        const bytecode::Instruction *code = m_Program.code.data();
+        const bytecode::Instruction *pc = code;
+
+#define DISPATCH() goto *s_Dispatch[static_cast<uint32_t>(pc->op)]
+#define NEXT() \
+    do         \
+    {          \
+        pc++;  \
+        DISPATCH(); \
+    } while (0)
+
+        DISPATCH();
+    loadk:
+        r[pc->a] = k[pc->b];
+        NEXT();
+    mov:
+        r[pc->a] = r[pc->b];
+        NEXT();
+    add:
+        r[pc->a] = r[pc->b] + r[pc->c];
+        NEXT();
+    sub:
+        r[pc->a] = r[pc->b] - r[pc->c];
+        NEXT();
+    mul:
+        r[pc->a] = r[pc->b] * r[pc->c];
+        NEXT();
+    div:
+        if (r[pc->c] == 0)
+            trap(SIGFPE);
+        r[pc->a] = r[pc->b] / r[pc->c];
+        NEXT();
+    eq:
+        r[pc->a] = r[pc->b] == r[pc->c];
+        NEXT();
+    ne:
+        r[pc->a] = r[pc->b] != r[pc->c];
+        NEXT();
+    lt:
+        r[pc->a] = r[pc->b] < r[pc->c];
+        NEXT();
+    le:
+        r[pc->a] = r[pc->b] <= r[pc->c];
+        NEXT();
+    gt:
+        r[pc->a] = r[pc->b] > r[pc->c];
+        NEXT();
+    ge:
+        r[pc->a] = r[pc->b] >= r[pc->c];
+        NEXT();
+    notOp:
+        r[pc->a] = !r[pc->b];
+        NEXT();
+    boolOp:
+        r[pc->a] = r[pc->b] != 0;
+        NEXT();
+    jmp:
+        pc = code + pc->a;
+        DISPATCH();
+    jz:
+        pc = r[pc->a] ? pc + 1 : code + pc->b;
+        DISPATCH();
+    jnz:
+        pc = r[pc->a] ? code + pc->b : pc + 1;
+        DISPATCH();
+    check:
+        // the UD2 of the native bounds check
+        if (r[pc->a] >= pc->b)
+            trap(SIGILL);
+        NEXT();
+    loade:
+        r[pc->a] = r[pc->b + r[pc->c]];
+        NEXT();
+    storee:
+        r[pc->a + r[pc->b]] = r[pc->c];
+        NEXT();
+    zero:
+        std::fill_n(r + pc->a, pc->b, 0);
+        NEXT();
+    call:
+    {
+        const bytecode::Function &function = m_Program.functions[pc->b];
+        calls.push_back({.pc = pc + 1, .base = base, .dst = pc->a});
+        base += pc->c;
+        if (stack.size() < base + function.frameSize)
+            stack.resize(std::max(stack.size() * 2, base + function.frameSize));
+        r = stack.data() + base;
+        pc = code + function.entry;
+        DISPATCH();
+    }
+    ret:
+    {
+        const uint64_t value = r[pc->a];
+        const Return caller = calls.back();
+        calls.pop_back();
+        base = caller.base;
+        r = stack.data() + base;
+        r[caller.dst] = value;
+        pc = caller.pc;
+        DISPATCH();
+    }
+    exit:
+        return r[pc->a];
+
+#undef NEXT
+#undef DISPATCH
+    }
+};
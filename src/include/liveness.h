@@ -0,0 +1,304 @@
+#pragma once
+
+#include "./node.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// the outcome of the liveness pass, keyed by the let and assignment nodes
+struct Liveness
+{
+    std::set<const void *> deadStores{};                          // stores whose value is never read, they aren't generated
+    std::map<const node::StatementLet *, std::string> slotDonors{}; // lets that take over the slot of a variable that is dead by then
+};
+
+// backward liveness over the variables of a frame, it finds the stores whose value is never read and the lets that
+// can take over the slot of a variable that is dead by then
+namespace liveness
+{
+    inline void collectIdents(const node::Expr *expr, std::set<std::string> &idents)
+    {
+        node::walkExpr(expr, [&](const node::ExprNode &node)
+                       {
+            if (const auto term = std::get_if<const node::Term *>(&node))
+            {
+                if (const auto termIdent = std::get_if<node::TermIdent *>(&(*term)->variant))
+                    idents.insert((*termIdent)->ident.value.value());
+                else if (const auto termIndex = std::get_if<node::TermIndex *>(&(*term)->variant))
+                    idents.insert((*termIndex)->ident.value.value());
+            }
+            return true; });
+    }
+
+    // an expression can be evaluated ahead of time if it can't trap, i.e. it only divides by non zero literals, calls nothing
+    // and only indexes arrays with literals, those are checked at compile time
+    inline bool isSpeculatable(const node::Expr *expr)
+    {
+        bool speculatable = true;
+        node::walkExpr(expr, [&](const node::ExprNode &node)
+                       {
+            // once a node traps, the rest of the expression doesn't matter
+            if (!speculatable)
+                return false;
+            if (const auto exprs = std::get_if<const node::Exprs *>(&node))
+            {
+                if (const auto div = std::get_if<node::ExprsDiv *>(&(*exprs)->variant))
+                    speculatable = node::asLiteral((*div)->rhs).value_or(0) != 0;
+            }
+            else if (const node::Term *term = std::get<const node::Term *>(node); std::holds_alternative<node::TermCall *>(term->variant))
+                speculatable = false;
+            else if (const auto termIndex = std::get_if<node::TermIndex *>(&term->variant))
+                speculatable = node::asLiteral((*termIndex)->index).has_value();
+            return speculatable; });
+        return speculatable;
+    }
+
+    // every variable a statement reads, writes or declares, nested statements included
+    inline void collectIdents(const node::Statement *statement, std::set<std::string> &idents)
+    {
+        struct IdentVisitor
+        {
+            std::set<std::string> &idents;
+            void operator()(const node::StatementExit *statementExit) const
+            {
+                collectIdents(statementExit->expr, idents);
+            }
+            void operator()(const node::StatementLet *statementLet) const
+            {
+                idents.insert(statementLet->ident.value.value());
+                collectIdents(statementLet->expr, idents);
+            }
+            void operator()(const node::Scope *scope) const
+            {
+                for (const node::Statement *nested : scope->statements)
+                    collectIdents(nested, idents);
+            }
+            void operator()(const node::StatementIf *statementIf) const
+            {
+                std::vector<node::Branch> branches{{.expr = statementIf->expr, .scope = statementIf->scope}};
+                if (statementIf->conditionalBr.has_value())
+                    node::collectBranches(statementIf->conditionalBr.value(), branches);
+                for (const node::Branch &branch : branches)
+                {
+                    if (branch.expr)
+                        collectIdents(branch.expr, idents);
+                    operator()(branch.scope);
+                }
+            }
+            void operator()(const node::StatementAssignment *statementAssign) const
+            {
+                idents.insert(statementAssign->ident.value.value());
+                collectIdents(statementAssign->expr, idents);
+                if (statementAssign->index)
+                    collectIdents(statementAssign->index, idents);
+            }
+            void operator()(const node::StatementWhile *statementWhile) const
+            {
+                collectIdents(statementWhile->expr, idents);
+                operator()(statementWhile->scope);
+            }
+            void operator()(const node::StatementFor *statementFor) const
+            {
+                operator()(statementFor->init);
+                collectIdents(statementFor->expr, idents);
+                operator()(statementFor->step);
+                operator()(statementFor->scope);
+            }
+            void operator()(const node::StatementReturn *statementReturn) const
+            {
+                collectIdents(statementReturn->expr, idents);
+            }
+            void operator()(const node::StatementCall *statementCall) const
+            {
+                for (const node::Expr *arg : statementCall->call->args)
+                    collectIdents(arg, idents);
+            }
+            void operator()(const node::StatementArray *statementArray) const
+            {
+                idents.insert(statementArray->ident.value.value());
+                if (statementArray->expr)
+                    collectIdents(statementArray->expr, idents);
+            }
+        };
+
+        std::visit(IdentVisitor{.idents = idents}, statement->variant);
+    }
+
+    // loopLiveness and analyzeLiveness call each other
+    inline void analyzeLiveness(const std::vector<node::Statement *> &statements, std::set<std::string> &live, Liveness *record);
+
+    // live before the step of a for loop, given what is live at the test after it
+    inline std::set<std::string> stepLiveness(const node::StatementAssignment *step, std::set<std::string> live)
+    {
+        if (!step)
+            return live;
+        if (!step->index)
+            live.erase(step->ident.value.value());
+        collectIdents(step->expr, live);
+        if (step->index)
+            collectIdents(step->index, live);
+        return live;
+    }
+
+    // live at the test of a loop. the body (and the step) runs between two tests, so it's iterated until
+    // the set settles, and only then analyzed once more to record its dead stores
+    inline std::set<std::string> loopLiveness(const node::Expr *expr, const node::Scope *scope, const node::StatementAssignment *step,
+                                              std::set<std::string> live, Liveness *record)
+    {
+        collectIdents(expr, live);
+        while (true)
+        {
+            std::set<std::string> body = stepLiveness(step, live);
+            analyzeLiveness(scope->statements, body, nullptr);
+            const size_t size = live.size();
+            live.insert(body.begin(), body.end());
+            if (live.size() == size)
+                break;
+        }
+        if (record)
+        {
+            std::set<std::string> body = stepLiveness(step, live);
+            analyzeLiveness(scope->statements, body, record);
+        }
+        return live;
+    }
+
+    // backward liveness over the variables of a frame: on entry live holds the variables that may still be read
+    // after the statements, on return the ones that may be read before them. a let or an assignment whose variable
+    // isn't live after it is a dead store, it's recorded when its expression can't trap or call anything
+    inline void analyzeLiveness(const std::vector<node::Statement *> &statements, std::set<std::string> &live, Liveness *record)
+    {
+        for (size_t i = node::reachableCount(statements); i > 0; i--)
+        {
+            const node::Statement *statement = statements[i - 1];
+            if (const auto statementExit = std::get_if<node::StatementExit *>(&statement->variant))
+            {
+                live.clear();
+                collectIdents((*statementExit)->expr, live);
+            }
+            else if (const auto statementReturn = std::get_if<node::StatementReturn *>(&statement->variant))
+            {
+                live.clear();
+                collectIdents((*statementReturn)->expr, live);
+            }
+            else if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+            {
+                const bool dead = !live.contains((*statementLet)->ident.value.value()) && isSpeculatable((*statementLet)->expr);
+                live.erase((*statementLet)->ident.value.value());
+                if (!dead)
+                    collectIdents((*statementLet)->expr, live);
+                else if (record)
+                    record->deadStores.insert(*statementLet);
+            }
+            else if (const auto assign = std::get_if<node::StatementAssignment *>(&statement->variant))
+            {
+                // an element store leaves the other elements as they are, it never kills the array
+                if ((*assign)->index)
+                {
+                    collectIdents((*assign)->index, live);
+                    collectIdents((*assign)->expr, live);
+                    continue;
+                }
+                const bool dead = !live.contains((*assign)->ident.value.value()) && isSpeculatable((*assign)->expr);
+                live.erase((*assign)->ident.value.value());
+                if (!dead)
+                    collectIdents((*assign)->expr, live);
+                else if (record)
+                    record->deadStores.insert(*assign);
+            }
+            else if (const auto statementArray = std::get_if<node::StatementArray *>(&statement->variant))
+            {
+                live.erase((*statementArray)->ident.value.value());
+                if ((*statementArray)->expr)
+                    collectIdents((*statementArray)->expr, live);
+            }
+            else if (const auto nested = std::get_if<node::Scope *>(&statement->variant))
+                analyzeLiveness((*nested)->statements, live, record);
+            else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            {
+                std::vector<node::Branch> branches{{.expr = (*statementIf)->expr, .scope = (*statementIf)->scope}};
+                if ((*statementIf)->conditionalBr.has_value())
+                    node::collectBranches((*statementIf)->conditionalBr.value(), branches);
+                // without an else the chain can fall through with nothing taken
+                std::set<std::string> before = branches.back().expr ? live : std::set<std::string>{};
+                for (const node::Branch &branch : branches)
+                {
+                    std::set<std::string> arm = live;
+                    analyzeLiveness(branch.scope->statements, arm, record);
+                    before.insert(arm.begin(), arm.end());
+                    if (branch.expr)
+                        collectIdents(branch.expr, before);
+                }
+                live = std::move(before);
+            }
+            else if (const auto statementWhile = std::get_if<node::StatementWhile *>(&statement->variant))
+                live = loopLiveness((*statementWhile)->expr, (*statementWhile)->scope, nullptr, std::move(live), record);
+            else if (const auto statementFor = std::get_if<node::StatementFor *>(&statement->variant))
+            {
+                live = loopLiveness((*statementFor)->expr, (*statementFor)->scope, (*statementFor)->step, std::move(live), record);
+                live.erase((*statementFor)->init->ident.value.value());
+                collectIdents((*statementFor)->init->expr, live);
+            }
+            else if (const auto statementCall = std::get_if<node::StatementCall *>(&statement->variant))
+                for (const node::Expr *arg : (*statementCall)->call->args)
+                    collectIdents(arg, live);
+        }
+    }
+
+    // a let takes over the slot of a variable declared before it in the same scope that is never mentioned
+    // again, so variables whose live ranges don't overlap share a slot. loop bodies are left alone, the
+    // slots of their lets are reserved in front of the loop
+    inline void assignSlots(const std::vector<node::Statement *> &statements, Liveness &liveness)
+    {
+        const size_t count = node::reachableCount(statements);
+        std::map<std::string, size_t> lastMention;
+        for (size_t i = 0; i < count; i++)
+        {
+            std::set<std::string> idents;
+            collectIdents(statements[i], idents);
+            for (const std::string &ident : idents)
+                lastMention[ident] = i;
+        }
+
+        std::vector<std::pair<size_t, std::string>> occupied; // the variables holding a slot, by their last mention
+        std::vector<std::string> free;                        // a dead variable for every slot that can be taken over
+        for (size_t i = 0; i < count; i++)
+        {
+            std::erase_if(occupied, [&](const std::pair<size_t, std::string> &occupant)
+                          {
+                if (occupant.first >= i)
+                    return false;
+                free.push_back(occupant.second);
+                return true; });
+
+            const node::Statement *statement = statements[i];
+            if (const auto statementLet = std::get_if<node::StatementLet *>(&statement->variant))
+            {
+                if (!free.empty())
+                {
+                    liveness.slotDonors[*statementLet] = free.back();
+                    free.pop_back();
+                }
+                occupied.emplace_back(lastMention[(*statementLet)->ident.value.value()], (*statementLet)->ident.value.value());
+            }
+            else if (const auto nested = std::get_if<node::Scope *>(&statement->variant))
+                assignSlots((*nested)->statements, liveness);
+            else if (const auto statementIf = std::get_if<node::StatementIf *>(&statement->variant))
+            {
+                std::vector<node::Branch> branches{{.expr = (*statementIf)->expr, .scope = (*statementIf)->scope}};
+                if ((*statementIf)->conditionalBr.has_value())
+                    node::collectBranches((*statementIf)->conditionalBr.value(), branches);
+                for (const node::Branch &branch : branches)
+                    assignSlots(branch.scope->statements, liveness);
+            }
+        }
+    }
+
+    // live holds the variables the code after the statements may still read
+    inline void analyzeFrame(const std::vector<node::Statement *> &statements, std::set<std::string> live, Liveness &liveness)
+    {
+        analyzeLiveness(statements, live, &liveness);
+        assignSlots(statements, liveness);
+    }
+}
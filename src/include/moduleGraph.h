@@ -0,0 +1,240 @@
+#pragma once
+
+#include "./codeGenerator.h"
+#include "./parser.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+// a .bl file, `import <name>;` refers to <name>.bl next to the program
+struct Module
+{
+    std::string name; // the file name without .bl, its object is <name>.o
+    std::filesystem::path path;
+    node::Prog prog;
+    std::vector<size_t> imports{}; // indices in the graph
+    // the source and the parser own the nodes of prog, the root's are the driver's
+    std::string source{};
+    std::unique_ptr<Scanner> scanner{};
+    std::unique_ptr<Parser> parser{};
+};
+
+// the program and every module it imports, directly or not. an imported module only declares functions,
+// and the imports can't form a cycle, so the modules can be compiled bottom up
+class ModuleGraph
+{
+private:
+    std::vector<std::unique_ptr<Module>> m_Modules; // the root first
+    std::map<std::string, size_t> m_Indices{};
+
+    size_t load(const std::string &name)
+    {
+        if (const auto itr = m_Indices.find(name); itr != m_Indices.end())
+            return itr->second;
+
+        auto module = std::make_unique<Module>();
+        module->name = name;
+        module->path = m_Modules.front()->path.parent_path() / (name + ".bl");
+        std::ifstream input(module->path);
+        if (!input.is_open())
+        {
+            std::cerr << "Error : Module not found : " << name << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::stringstream buf;
+        buf << input.rdbuf();
+        module->source = buf.str();
+        module->scanner = std::make_unique<Scanner>(module->source);
+        module->parser = std::make_unique<Parser>(*module->scanner);
+        const std::optional<node::Prog> prog = module->parser->parseProg();
+        if (!prog.has_value())
+        {
+            std::cerr << "Error : Invalid program" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (!prog.value().statements.empty())
+        {
+            std::cerr << "Error : Module " << name << " has statements outside of functions" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        module->prog = prog.value();
+        m_Indices.emplace(name, m_Modules.size());
+        m_Modules.push_back(std::move(module));
+        return m_Modules.size() - 1;
+    }
+
+    // every module is imported after the modules it imports
+    void checkCycles() const
+    {
+        std::vector<size_t> waiting(m_Modules.size());
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < m_Modules.size(); i++)
+            if (!(waiting[i] = m_Modules[i]->imports.size()))
+                ready.push_back(i);
+        size_t sorted = 0;
+        while (!ready.empty())
+        {
+            const size_t index = ready.back();
+            ready.pop_back();
+            sorted++;
+            for (size_t i = 0; i < m_Modules.size(); i++)
+                if (std::ranges::find(m_Modules[i]->imports, index) != m_Modules[i]->imports.end() && --waiting[i] == 0)
+                    ready.push_back(i);
+        }
+        if (sorted != m_Modules.size())
+        {
+            std::cerr << "Error : Import cycle" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+public:
+    // the root has been parsed by the driver, the modules it imports are loaded from its directory
+    inline ModuleGraph(const std::filesystem::path &path, const node::Prog &prog)
+    {
+        m_Modules.push_back(std::make_unique<Module>(Module{.name = path.stem().string(), .path = path, .prog = prog}));
+        m_Indices.emplace(m_Modules.front()->name, 0);
+        for (size_t i = 0; i < m_Modules.size(); i++)
+            for (const Token &import : m_Modules[i]->prog.imports)
+            {
+                const size_t index = load(import.value.value());
+                if (std::ranges::find(m_Modules[i]->imports, index) == m_Modules[i]->imports.end())
+                    m_Modules[i]->imports.push_back(index);
+            }
+        checkCycles();
+    }
+
+    inline ModuleGraph(const ModuleGraph &graph) = delete;
+
+    inline ModuleGraph operator=(const ModuleGraph &graph) = delete;
+
+    const Module &root() const
+    {
+        return *m_Modules.front();
+    }
+
+    // every call of a module is to one of its own functions or to one of a module it imports directly. the
+    // generator of the merged program sees every function, so it's checked here, like a separate compilation would
+    void checkCalls(const Module &module) const
+    {
+        std::set<std::string> visible;
+        for (const node::Function *function : module.prog.functions)
+            visible.insert(function->ident.value.value());
+        for (const node::Function *function : imported(module))
+            visible.insert(function->ident.value.value());
+        std::vector<const node::TermCall *> calls;
+        const node::Scope statements{.statements = module.prog.statements};
+        CodeGenerator::collectCalls(&statements, calls);
+        for (const node::Function *function : module.prog.functions)
+            CodeGenerator::collectCalls(function->scope, calls);
+        for (const node::TermCall *call : calls)
+            if (!visible.contains(call->ident.value.value()))
+            {
+                std::cerr << "Error : Undeclared function : " << call->ident.value.value() << std::endl;
+                exit(EXIT_FAILURE);
+            }
+    }
+
+    // the whole program in one: the root with the functions of every module
+    node::Prog merged() const
+    {
+        for (const auto &module : m_Modules)
+            checkCalls(*module);
+        node::Prog prog = root().prog;
+        for (size_t i = 1; i < m_Modules.size(); i++)
+            prog.functions.insert(prog.functions.end(), m_Modules[i]->prog.functions.begin(), m_Modules[i]->prog.functions.end());
+        return prog;
+    }
+
+    // the functions a module can call in the modules it imports
+    std::vector<const node::Function *> imported(const Module &module) const
+    {
+        std::vector<const node::Function *> functions;
+        for (const size_t index : module.imports)
+            functions.insert(functions.end(), m_Modules[index]->prog.functions.begin(), m_Modules[index]->prog.functions.end());
+        return functions;
+    }
+
+    // an object is out of date when it was compiled with other flags, the ones in the .flags file next to it,
+    // or when its source is newer, or the source of a module it imports, whose functions it calls. a change
+    // further down doesn't matter, it can't change the imported signatures
+    bool isUpToDate(const Module &module, const std::filesystem::path &object, const std::string &flags) const
+    {
+        std::error_code error;
+        const auto built = std::filesystem::last_write_time(object, error);
+        if (error || std::filesystem::last_write_time(module.path) > built)
+            return false;
+        std::ifstream input(std::filesystem::path(object).replace_extension(".flags"));
+        std::stringstream written;
+        written << input.rdbuf();
+        if (!input.is_open() || written.str() != flags)
+            return false;
+        return std::ranges::none_of(module.imports, [&](const size_t index)
+                                    { return std::filesystem::last_write_time(m_Modules[index]->path) > built; });
+    }
+
+    // runs compile for every module on up to `jobs` threads, a module starts once the modules it imports are
+    // done. returns false when a compile fails, the modules that weren't started by then are skipped
+    bool build(const std::function<bool(const Module &)> &compile, const size_t jobs) const
+    {
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<size_t> waiting(m_Modules.size());
+        std::vector<std::vector<size_t>> importers(m_Modules.size());
+        std::deque<size_t> ready;
+        size_t done = 0;
+        bool failed = false;
+        for (size_t i = 0; i < m_Modules.size(); i++)
+        {
+            waiting[i] = m_Modules[i]->imports.size();
+            for (const size_t index : m_Modules[i]->imports)
+                importers[index].push_back(i);
+            if (!waiting[i])
+                ready.push_back(i);
+        }
+
+        const auto worker = [&]
+        {
+            std::unique_lock lock(mutex);
+            while (true)
+            {
+                changed.wait(lock, [&]
+                             { return !ready.empty() || failed || done == m_Modules.size(); });
+                if (failed || ready.empty())
+                    return;
+                const size_t index = ready.front();
+                ready.pop_front();
+                lock.unlock();
+                const bool compiled = compile(*m_Modules[index]);
+                lock.lock();
+                done++;
+                failed |= !compiled;
+                for (const size_t importer : importers[index])
+                    if (--waiting[importer] == 0)
+                        ready.push_back(importer);
+                changed.notify_all();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < std::clamp<size_t>(jobs, 1, m_Modules.size()); i++)
+            threads.emplace_back(worker);
+        for (std::thread &thread : threads)
+            thread.join();
+        return !failed;
+    }
+
+    const std::vector<std::unique_ptr<Module>> &modules() const
+    {
+        return m_Modules;
+    }
+};
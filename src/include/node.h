@@ -1,6 +1,10 @@
 #pragma once
 
 #include "./token.h"
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
 #include <vector>
 #include <variant>
 
@@ -23,6 +27,26 @@ namespace node
         Expr *expr;
     };
 
+    struct TermCall
+    {
+        Token ident;
+        std::vector<node::Expr *> args;
+    };
+
+    // an element of an array, a[index]
+    struct TermIndex
+    {
+        Token ident;
+        Expr *index{};
+    };
+
+    struct Term;
+
+    struct TermNot
+    {
+        Term *term;
+    };
+
     struct ExprsAdd
     {
         Expr *lhs, *rhs;
@@ -43,14 +67,57 @@ namespace node
         Expr *lhs, *rhs;
     };
 
+    struct ExprsEq
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsNotEq
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsLess
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsLessEq
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsGreater
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsGreaterEq
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsAnd
+    {
+        Expr *lhs, *rhs;
+    };
+
+    struct ExprsOr
+    {
+        Expr *lhs, *rhs;
+    };
+
     struct Exprs
     {
-        std::variant<node::ExprsAdd *, node::ExprsSub *, node::ExprsMul *, node::ExprsDiv *> variant;
+        std::variant<node::ExprsAdd *, node::ExprsSub *, node::ExprsMul *, node::ExprsDiv *,
+                     node::ExprsEq *, node::ExprsNotEq *, node::ExprsLess *, node::ExprsLessEq *,
+                     node::ExprsGreater *, node::ExprsGreaterEq *, node::ExprsAnd *, node::ExprsOr *>
+            variant;
     };
 
     struct Term
     {
-        std::variant<node::TermIntLit *, node::TermIdent *, node::TermParenthesis *> variant;
+        std::variant<node::TermIntLit *, node::TermIdent *, node::TermParenthesis *, node::TermNot *, node::TermCall *, node::TermIndex *> variant;
     };
 
     struct Expr
@@ -101,18 +168,180 @@ namespace node
         std::optional<node::ConditionalBranch *> conditionalBr;
     };
 
+    // a[index] = expr stores a single element, without an index the whole array is assigned element-wise
     struct StatementAssignment
     {
         Token ident;
         Expr *expr{};
+        Expr *index{};
+    };
+
+    // let a[size]; is zeroed, let a[size] = expr; is initialized element-wise
+    struct StatementArray
+    {
+        Token ident;
+        Token size;
+        Expr *expr{};
+    };
+
+    struct StatementWhile
+    {
+        Expr *expr{};
+        Scope *scope{};
+    };
+
+    struct StatementFor
+    {
+        StatementLet *init{};
+        Expr *expr{};
+        StatementAssignment *step{};
+        Scope *scope{};
+    };
+
+    struct StatementReturn
+    {
+        Expr *expr{};
+    };
+
+    // a call whose result is discarded
+    struct StatementCall
+    {
+        TermCall *call{};
     };
 
     struct Statement
     {
-        std::variant<node::StatementExit *, node::StatementLet *, node::Scope *, node::StatementIf *, node::StatementAssignment*> variant;
+        std::variant<node::StatementExit *, node::StatementLet *, node::Scope *, node::StatementIf *, node::StatementAssignment *,
+                     node::StatementWhile *, node::StatementFor *, node::StatementReturn *, node::StatementCall *, node::StatementArray *>
+            variant;
+        int line{};
     };
+
+    struct Function
+    {
+        Token ident;
+        std::vector<Token> params;
+        Scope *scope{};
+    };
+
     struct Prog
     {
         std::vector<node::Statement *> statements;
+        std::vector<node::Function *> functions;
+        std::vector<Token> imports; // import <ident>; loads <ident>.bl from the directory of the program
     };
-}
\ No newline at end of file
+
+    // queries on the tree the code generator and the liveness pass share
+
+    // what the passes over an expression visit: an operator or a term
+    using ExprNode = std::variant<const Term *, const Exprs *>;
+
+    inline ExprNode asNode(const Expr *expr)
+    {
+        return std::visit([](const auto *node) -> ExprNode
+                          { return node; },
+                          expr->variant);
+    }
+
+    // every node of an expression, parents before their children. fn returns false to skip the children of a node
+    template <typename Fn>
+    void walkExpr(const Expr *expr, Fn &&fn)
+    {
+        std::vector<ExprNode> nodes{asNode(expr)};
+        while (!nodes.empty())
+        {
+            const ExprNode node = nodes.back();
+            nodes.pop_back();
+            if (!fn(node))
+                continue;
+            if (const auto exprs = std::get_if<const Exprs *>(&node))
+            {
+                std::visit([&](const auto *opr)
+                           { nodes.push_back(asNode(opr->rhs)); nodes.push_back(asNode(opr->lhs)); },
+                           (*exprs)->variant);
+                continue;
+            }
+            const Term *term = std::get<const Term *>(node);
+            if (const auto termParenthesis = std::get_if<TermParenthesis *>(&term->variant))
+                nodes.push_back(asNode((*termParenthesis)->expr));
+            else if (const auto termNot = std::get_if<TermNot *>(&term->variant))
+                nodes.push_back((*termNot)->term);
+            else if (const auto termCall = std::get_if<TermCall *>(&term->variant))
+                for (auto arg = (*termCall)->args.rbegin(); arg != (*termCall)->args.rend(); arg++)
+                    nodes.push_back(asNode(*arg));
+            else if (const auto termIndex = std::get_if<TermIndex *>(&term->variant))
+                nodes.push_back(asNode((*termIndex)->index));
+        }
+    }
+
+    // an if statement flattened to its arms, the else arm has no condition
+    struct Branch
+    {
+        const Expr *expr;
+        const Scope *scope;
+    };
+
+    inline void collectBranches(const ConditionalBranch *conditionalBr, std::vector<Branch> &branches)
+    {
+        struct ConditionalBranchVisitor
+        {
+            std::vector<Branch> &branches;
+
+            void operator()(const ConditionalBranchElif *conditionalBrElif) const
+            {
+                branches.push_back({.expr = conditionalBrElif->expr, .scope = conditionalBrElif->scope});
+                if (conditionalBrElif->conditionalBr.has_value())
+                    collectBranches(conditionalBrElif->conditionalBr.value(), branches);
+            }
+            void operator()(const ConditionalBranchElse *conditionalBrElse) const
+            {
+                branches.push_back({.expr = nullptr, .scope = conditionalBrElse->scope});
+            }
+        };
+
+        ConditionalBranchVisitor visitor{.branches = branches};
+        std::visit(visitor, conditionalBr->variant);
+    }
+
+    // nothing after exit or return in the same scope is reachable
+    inline bool isExit(const Statement *statement)
+    {
+        return std::holds_alternative<StatementExit *>(statement->variant) ||
+               std::holds_alternative<StatementReturn *>(statement->variant);
+    }
+
+    // the statements up to and including the first exit or return
+    inline size_t reachableCount(const std::vector<Statement *> &statements)
+    {
+        const auto itr = std::ranges::find_if(statements, isExit);
+        return itr == statements.end() ? statements.size() : itr - statements.begin() + 1;
+    }
+
+    inline const Expr *stripParenthesis(const Expr *expr)
+    {
+        while (const auto term = std::get_if<Term *>(&expr->variant))
+        {
+            const auto termParenthesis = std::get_if<TermParenthesis *>(&(*term)->variant);
+            if (!termParenthesis)
+                break;
+            expr = (*termParenthesis)->expr;
+        }
+        return expr;
+    }
+
+    // nullptr if the expression isn't a term once the parentheses are stripped
+    inline const Term *asTerm(const Expr *expr)
+    {
+        const auto term = std::get_if<Term *>(&stripParenthesis(expr)->variant);
+        return term ? *term : nullptr;
+    }
+
+    inline std::optional<uint64_t> asLiteral(const Expr *expr)
+    {
+        const Term *term = asTerm(expr);
+        const auto intLit = term ? std::get_if<TermIntLit *>(&term->variant) : nullptr;
+        if (!intLit)
+            return {};
+        return std::stoull((*intLit)->int_literal.value.value());
+    }
+}
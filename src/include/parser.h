@@ -3,24 +3,35 @@
 #include "./arenaAllocator.h"
 #include "./node.h"
 #include "./scanner.h"
+#include <deque>
 
 class Parser
 {
 private:
-    const std::vector<Token> m_Tokens;
-    mutable size_t m_Count;
+    // the tokens are pulled from the scanner as the parser looks at them, only the lookahead is buffered
+    Scanner &m_Scanner;
+    mutable std::deque<Token> m_Tokens;
+    mutable std::optional<Token> m_Last; // the last consumed token, for the line of an error
     ArenaAllocator m_ArenaAllocator;
 
     inline std::optional<Token> lookAhead(const size_t ahead = 0) const
     {
-        if (m_Count + ahead >= m_Tokens.size())
-            return {};
-        return m_Tokens.at(m_Count + ahead);
+        while (m_Tokens.size() <= ahead)
+        {
+            auto token = m_Scanner.next();
+            if (!token.has_value())
+                return {};
+            m_Tokens.push_back(std::move(token.value()));
+        }
+        return m_Tokens.at(ahead);
     }
 
     inline Token getNextToken() const
     {
-        return m_Tokens.at(m_Count++);
+        lookAhead();
+        m_Last = std::move(m_Tokens.front());
+        m_Tokens.pop_front();
+        return m_Last.value();
     }
     //To-Do : write a function that maps the token type and give you the string token, and then remove the second arg from this fun
     inline Token trytoGetNextToken(const TokenTypes type, const std::string &errMsg) 
@@ -42,121 +53,274 @@ private:
 
     void logError(const std::string &errMsg)
     {
-        std::cerr << "[Prasing Error] Expected " << errMsg << " on line " << lookAhead(-1).value().line << std::endl;
+        std::cerr << "[Prasing Error] Expected " << errMsg << " on line " << (m_Last.has_value() ? m_Last.value().line : 1) << std::endl;
         exit(EXIT_FAILURE);
     }
 
+    // every binary operator node has the same lhs/rhs shape
+    template <typename T>
+    node::Exprs *makeExprs(node::Expr *lhs, node::Expr *rhs)
+    {
+        auto opr = m_ArenaAllocator.allocate<T>();
+        opr->lhs = lhs;
+        opr->rhs = rhs;
+        auto exprs = m_ArenaAllocator.allocate<node::Exprs>();
+        exprs->variant = opr;
+        return exprs;
+    }
+
 public:
-    inline Parser(const std::vector<Token> &tokens) : m_Tokens(tokens), m_Count(0), m_ArenaAllocator(1024 * 1024 * 4) {}
+    inline explicit Parser(Scanner &scanner) : m_Scanner(scanner), m_ArenaAllocator(1024 * 1024 * 4) {}
 
-    std::optional<node::Term *> parseTerm()
+    // the nodes parsed after a mark are released by rewinding to it, see CodeGenerator::streamStatement
+    ArenaAllocator::Mark mark() const
     {
-        if (const auto intLit = trytoGetNextToken(TokenTypes::int_literals))
-        {
-            auto termIntLit = m_ArenaAllocator.allocate<node::TermIntLit>();
-            termIntLit->int_literal = intLit.value();
-            auto term = m_ArenaAllocator.allocate<node::Term>();
-            term->variant = termIntLit;
-            return term;
-        }
-        if (const auto ident = trytoGetNextToken(TokenTypes::ident))
-        {
-            auto exprIdent = m_ArenaAllocator.allocate<node::TermIdent>();
-            exprIdent->ident = ident.value();
-            auto term = m_ArenaAllocator.allocate<node::Term>();
-            term->variant = exprIdent;
-            return term;
-        }
-        if (const auto openParenthesis = trytoGetNextToken(TokenTypes::open_parenthesis))
+        return m_ArenaAllocator.mark();
+    }
+
+    void rewind(const ArenaAllocator::Mark &mark)
+    {
+        m_ArenaAllocator.rewind(mark);
+    }
+
+    bool hasMore() const
+    {
+        return lookAhead().has_value();
+    }
+
+    // <Ident>(<Expr>, ...)
+    std::optional<node::TermCall *> parseCall()
+    {
+        if (!(lookAhead().has_value() && lookAhead().value().type == TokenTypes::ident &&
+              lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::open_parenthesis))
+            return {};
+
+        auto call = m_ArenaAllocator.allocate<node::TermCall>();
+        call->ident = getNextToken();
+        getNextToken(); // for the `(`
+        if (!trytoGetNextToken(TokenTypes::close_parenthesis))
         {
-            auto expr = parseExpr();
-            if (!expr.has_value())
+            do
             {
-                logError("Expression");
-            }
-            trytoGetNextToken(TokenTypes::close_parenthesis, " `)`");
-            auto termParenthesis = m_ArenaAllocator.allocate<node::TermParenthesis>();
-            termParenthesis->expr = expr.value();
-            auto term = m_ArenaAllocator.allocate<node::Term>();
-            term->variant = termParenthesis;
-            return term;
+                if (const auto expr = parseExpr())
+                    call->args.push_back(expr.value());
+                else
+                    logError("Expression");
+            } while (trytoGetNextToken(TokenTypes::comma));
+            trytoGetNextToken(TokenTypes::close_parenthesis, "`)`");
         }
-        return {};
+        return call;
     }
 
-    std::optional<node::Expr *> parseExpr(const int minPrecedence = 0)
+    node::Expr *makeExpr(node::Term *term)
     {
-        std::optional<node::Term *> termLhs = parseTerm();
-        if (!termLhs.has_value())
-            return {};
-
-        auto exprLhs = m_ArenaAllocator.allocate<node::Expr>();
-        exprLhs->variant = termLhs.value();
+        auto expr = m_ArenaAllocator.allocate<node::Expr>();
+        expr->variant = term;
+        return expr;
+    }
 
-        while (true)
+    node::Exprs *makeBinary(const TokenTypes opr, node::Expr *lhs, node::Expr *rhs)
+    {
+        switch (opr)
         {
-            std::optional<Token> currToken = lookAhead();
+        case TokenTypes::plus:
+            return makeExprs<node::ExprsAdd>(lhs, rhs);
+        case TokenTypes::sub:
+            return makeExprs<node::ExprsSub>(lhs, rhs);
+        case TokenTypes::mul:
+            return makeExprs<node::ExprsMul>(lhs, rhs);
+        case TokenTypes::div:
+            return makeExprs<node::ExprsDiv>(lhs, rhs);
+        case TokenTypes::eq_eq:
+            return makeExprs<node::ExprsEq>(lhs, rhs);
+        case TokenTypes::bang_eq:
+            return makeExprs<node::ExprsNotEq>(lhs, rhs);
+        case TokenTypes::less:
+            return makeExprs<node::ExprsLess>(lhs, rhs);
+        case TokenTypes::less_eq:
+            return makeExprs<node::ExprsLessEq>(lhs, rhs);
+        case TokenTypes::greater:
+            return makeExprs<node::ExprsGreater>(lhs, rhs);
+        case TokenTypes::greater_eq:
+            return makeExprs<node::ExprsGreaterEq>(lhs, rhs);
+        case TokenTypes::and_and:
+            return makeExprs<node::ExprsAnd>(lhs, rhs);
+        case TokenTypes::or_or:
+            return makeExprs<node::ExprsOr>(lhs, rhs);
+        default:
+            std::cout << "Error : Unkown operation unable to parse" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
 
-            if (!currToken.has_value())
-                break;
+    // what parseExpr has on its operator stack: a binary operator, or a construct that is still open
+    struct Pending
+    {
+        enum class Kind
+        {
+            binary,
+            parenthesis,
+            bang,
+            call,
+            index
+        } kind;
+        TokenTypes opr{};
+        int precedence{};
+        node::Term *term{}; // the call or the index whose operands are being parsed
+    };
 
-            std::optional<int> precedence = exprsPrecedence(currToken->type);
+    // pops the binary operators down to the first one below minPrecedence or the innermost open construct
+    void reduce(std::vector<node::Expr *> &operands, std::vector<Pending> &pending, const int minPrecedence)
+    {
+        while (!pending.empty() && pending.back().kind == Pending::Kind::binary && pending.back().precedence >= minPrecedence)
+        {
+            node::Expr *rhs = operands.back();
+            operands.pop_back();
+            node::Expr *lhs = operands.back();
+            operands.pop_back();
+            auto expr = m_ArenaAllocator.allocate<node::Expr>();
+            expr->variant = makeBinary(pending.back().opr, lhs, rhs);
+            operands.push_back(expr);
+            pending.pop_back();
+        }
+    }
 
-            if (!precedence.has_value() || precedence < minPrecedence)
-                break;
+    // a finished term, with the `!`s in front of it applied
+    void pushOperand(node::Term *term, std::vector<node::Expr *> &operands, std::vector<Pending> &pending)
+    {
+        while (!pending.empty() && pending.back().kind == Pending::Kind::bang)
+        {
+            auto termNot = m_ArenaAllocator.allocate<node::TermNot>();
+            termNot->term = term;
+            term = m_ArenaAllocator.allocate<node::Term>();
+            term->variant = termNot;
+            pending.pop_back();
+        }
+        operands.push_back(makeExpr(term));
+    }
 
-            const Token opr = getNextToken();
-            const int nextMinPrecedence = precedence.value() + 1;
-            auto exprRhs = parseExpr(nextMinPrecedence);
+    // operator precedence parsing with explicit operand and operator stacks instead of recursion, so how deep
+    // an expression nests is only limited by the heap. operators of the same precedence associate to the left
+    std::optional<node::Expr *> parseExpr()
+    {
+        std::vector<node::Expr *> operands;
+        std::vector<Pending> pending;
+        bool expectOperand = true;
 
-            if (!exprRhs.has_value())
+        while (true)
+        {
+            if (expectOperand)
             {
-                logError("Expression");
+                const bool ident = lookAhead().has_value() && lookAhead().value().type == TokenTypes::ident;
+                const std::optional<Token> next = lookAhead(1);
+                if (trytoGetNextToken(TokenTypes::open_parenthesis))
+                {
+                    pending.push_back({.kind = Pending::Kind::parenthesis});
+                }
+                else if (trytoGetNextToken(TokenTypes::bang))
+                {
+                    pending.push_back({.kind = Pending::Kind::bang});
+                }
+                else if (ident && next.has_value() && next.value().type == TokenTypes::open_parenthesis)
+                {
+                    auto call = m_ArenaAllocator.allocate<node::TermCall>();
+                    call->ident = getNextToken();
+                    getNextToken(); // for the `(`
+                    auto term = m_ArenaAllocator.allocate<node::Term>();
+                    term->variant = call;
+                    if (trytoGetNextToken(TokenTypes::close_parenthesis))
+                    {
+                        pushOperand(term, operands, pending);
+                        expectOperand = false;
+                    }
+                    else
+                        pending.push_back({.kind = Pending::Kind::call, .term = term});
+                }
+                else if (ident && next.has_value() && next.value().type == TokenTypes::open_bracket)
+                {
+                    auto termIndex = m_ArenaAllocator.allocate<node::TermIndex>();
+                    termIndex->ident = getNextToken();
+                    getNextToken(); // for the `[`
+                    auto term = m_ArenaAllocator.allocate<node::Term>();
+                    term->variant = termIndex;
+                    pending.push_back({.kind = Pending::Kind::index, .term = term});
+                }
+                else if (const auto intLit = trytoGetNextToken(TokenTypes::int_literals))
+                {
+                    auto termIntLit = m_ArenaAllocator.allocate<node::TermIntLit>();
+                    termIntLit->int_literal = intLit.value();
+                    auto term = m_ArenaAllocator.allocate<node::Term>();
+                    term->variant = termIntLit;
+                    pushOperand(term, operands, pending);
+                    expectOperand = false;
+                }
+                else if (ident)
+                {
+                    auto exprIdent = m_ArenaAllocator.allocate<node::TermIdent>();
+                    exprIdent->ident = getNextToken();
+                    auto term = m_ArenaAllocator.allocate<node::Term>();
+                    term->variant = exprIdent;
+                    pushOperand(term, operands, pending);
+                    expectOperand = false;
+                }
+                else if (operands.empty() && pending.empty())
+                {
+                    return {};
+                }
+                else
+                {
+                    logError(pending.back().kind == Pending::Kind::bang ? "Term" : "Expression");
+                }
+                continue;
             }
-            auto exprs = m_ArenaAllocator.allocate<node::Exprs>();
-            auto exprLhs2 = m_ArenaAllocator.allocate<node::Expr>();
 
-            if (opr.type == TokenTypes::plus)
-            {
-                auto add = m_ArenaAllocator.allocate<node::ExprsAdd>();
-                exprLhs2->variant = exprLhs->variant;
-                add->lhs = exprLhs2;
-                add->rhs = exprRhs.value();
-                exprs->variant = add;
-            }
-            else if (opr.type == TokenTypes::mul)
+            const std::optional<Token> currToken = lookAhead();
+            const std::optional<int> precedence = currToken.has_value() ? exprsPrecedence(currToken->type) : std::nullopt;
+            if (precedence.has_value())
             {
-                auto mul = m_ArenaAllocator.allocate<node::ExprsMul>();
-                exprLhs2->variant = exprLhs->variant;
-                mul->lhs = exprLhs2;
-                mul->rhs = exprRhs.value();
-                exprs->variant = mul;
+                reduce(operands, pending, precedence.value());
+                pending.push_back({.kind = Pending::Kind::binary, .opr = getNextToken().type, .precedence = precedence.value()});
+                expectOperand = true;
+                continue;
             }
-            else if (opr.type == TokenTypes::sub)
+
+            // anything else closes the innermost open construct, or ends the expression when there is none
+            reduce(operands, pending, 0);
+            if (pending.empty())
+                break;
+            const Pending open = pending.back();
+            pending.pop_back();
+            node::Expr *inner = operands.back();
+            operands.pop_back();
+            if (open.kind == Pending::Kind::parenthesis)
             {
-                auto sub = m_ArenaAllocator.allocate<node::ExprsSub>();
-                exprLhs2->variant = exprLhs->variant;
-                sub->lhs = exprLhs2;
-                sub->rhs = exprRhs.value();
-                exprs->variant = sub;
+                trytoGetNextToken(TokenTypes::close_parenthesis, " `)`");
+                auto termParenthesis = m_ArenaAllocator.allocate<node::TermParenthesis>();
+                termParenthesis->expr = inner;
+                auto term = m_ArenaAllocator.allocate<node::Term>();
+                term->variant = termParenthesis;
+                pushOperand(term, operands, pending);
             }
-            else if (opr.type == TokenTypes::div)
+            else if (open.kind == Pending::Kind::call)
             {
-                auto div = m_ArenaAllocator.allocate<node::ExprsDiv>();
-                exprLhs2->variant = exprLhs->variant;
-                div->lhs = exprLhs2;
-                div->rhs = exprRhs.value();
-                exprs->variant = div;
+                std::get<node::TermCall *>(open.term->variant)->args.push_back(inner);
+                if (trytoGetNextToken(TokenTypes::comma))
+                {
+                    pending.push_back(open);
+                    expectOperand = true;
+                    continue;
+                }
+                trytoGetNextToken(TokenTypes::close_parenthesis, "`)`");
+                pushOperand(open.term, operands, pending);
             }
             else
             {
-                std::cout << "Error : Unkown operation unable to parse" << std::endl;
-                exit(EXIT_FAILURE);
+                std::get<node::TermIndex *>(open.term->variant)->index = inner;
+                trytoGetNextToken(TokenTypes::close_bracket, "`]`");
+                pushOperand(open.term, operands, pending);
             }
-
-            exprLhs->variant = exprs;
         }
-        return exprLhs;
+        return operands.back();
     }
 
     std::optional<node::ConditionalBranch *> parseConditionalBr()
@@ -217,29 +381,54 @@ public:
         return scope;
     }
 
-    std::optional<node::Statement *> parseStatement()
+    // <Ident>[<Expr>]
+    std::optional<node::TermIndex *> parseIndex()
     {
-        if (lookAhead().has_value() && lookAhead().value().type == TokenTypes::exit && lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::open_parenthesis)
-        {
-            getNextToken();
-            getNextToken();
+        if (!(lookAhead().has_value() && lookAhead().value().type == TokenTypes::ident &&
+              lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::open_bracket))
+            return {};
 
-            auto exit_statement = m_ArenaAllocator.allocate<node::StatementExit>();
+        auto termIndex = m_ArenaAllocator.allocate<node::TermIndex>();
+        termIndex->ident = getNextToken();
+        getNextToken(); // for the `[`
+        if (const auto expr = parseExpr())
+            termIndex->index = expr.value();
+        else
+            logError("Expression");
+        trytoGetNextToken(TokenTypes::close_bracket, "`]`");
+        return termIndex;
+    }
 
-            if (const auto expr_node = parseExpr())
-            {
-                exit_statement->expr = expr_node.value();
-            }
+    // let <Ident>[<IntLit>]; or let <Ident>[<IntLit>] = <Expr>;
+    std::optional<node::StatementArray *> parseArray()
+    {
+        if (!(lookAhead().has_value() && lookAhead().value().type == TokenTypes::let &&
+              lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::ident &&
+              lookAhead(2).has_value() && lookAhead(2).value().type == TokenTypes::open_bracket))
+            return {};
+
+        getNextToken();
+        auto statementArray = m_ArenaAllocator.allocate<node::StatementArray>();
+        statementArray->ident = getNextToken();
+        getNextToken(); // for the `[`
+        if (const auto size = trytoGetNextToken(TokenTypes::int_literals))
+            statementArray->size = size.value();
+        else
+            logError("Array size");
+        trytoGetNextToken(TokenTypes::close_bracket, "`]`");
+        if (trytoGetNextToken(TokenTypes::eq))
+        {
+            if (const auto expr = parseExpr())
+                statementArray->expr = expr.value();
             else
-            {
                 logError("Expression");
-            }
-            trytoGetNextToken(TokenTypes::close_parenthesis, "`)`");
-            trytoGetNextToken(TokenTypes::semicolon, "`;`");
-            auto statement = m_ArenaAllocator.allocate<node::Statement>();
-            statement->variant = exit_statement;
-            return statement;
         }
+        trytoGetNextToken(TokenTypes::semicolon, "`;`");
+        return statementArray;
+    }
+
+    std::optional<node::StatementLet *> parseLet()
+    {
         if (lookAhead().has_value() && lookAhead().value().type == TokenTypes::let &&
             lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::ident &&
             lookAhead(2).has_value() && lookAhead(2).value().type == TokenTypes::eq)
@@ -260,10 +449,14 @@ public:
                 logError("Expression");
             }
             trytoGetNextToken(TokenTypes::semicolon, "`;`");
-            auto statement = m_ArenaAllocator.allocate<node::Statement>();
-            statement->variant = statementLet;
-            return statement;
+            return statementLet;
         }
+        return {};
+    }
+
+    // the `;` is left to the caller, the step of a for loop is closed by `)` instead
+    std::optional<node::StatementAssignment *> parseAssignment()
+    {
         if (lookAhead().has_value() && lookAhead().value().type == TokenTypes::ident &&
             lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::eq)
         {
@@ -279,10 +472,85 @@ public:
             {
                 logError("Expression");
             }
+            return assgin;
+        }
+        if (auto element = parseIndex())
+        {
+            const auto assgin = m_ArenaAllocator.allocate<node::StatementAssignment>();
+            assgin->ident = element.value()->ident;
+            assgin->index = element.value()->index;
+            trytoGetNextToken(TokenTypes::eq, "`=`");
+            if (auto expr = parseExpr())
+            {
+                assgin->expr = expr.value();
+            }
+            else
+            {
+                logError("Expression");
+            }
+            return assgin;
+        }
+        return {};
+    }
 
+    std::optional<node::Statement *> parseStatement()
+    {
+        const int line = lookAhead().has_value() ? lookAhead().value().line : 0;
+        auto statement = parseStatementKind();
+        if (statement.has_value())
+            statement.value()->line = line;
+        return statement;
+    }
+
+    std::optional<node::Statement *> parseStatementKind()
+    {
+        if (lookAhead().has_value() && lookAhead().value().type == TokenTypes::exit && lookAhead(1).has_value() && lookAhead(1).value().type == TokenTypes::open_parenthesis)
+        {
+            getNextToken();
+            getNextToken();
+
+            auto exit_statement = m_ArenaAllocator.allocate<node::StatementExit>();
+
+            if (const auto expr_node = parseExpr())
+            {
+                exit_statement->expr = expr_node.value();
+            }
+            else
+            {
+                logError("Expression");
+            }
+            trytoGetNextToken(TokenTypes::close_parenthesis, "`)`");
+            trytoGetNextToken(TokenTypes::semicolon, "`;`");
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = exit_statement;
+            return statement;
+        }
+        if (auto statementArray = parseArray())
+        {
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementArray.value();
+            return statement;
+        }
+        if (auto statementLet = parseLet())
+        {
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementLet.value();
+            return statement;
+        }
+        if (auto call = parseCall())
+        {
+            trytoGetNextToken(TokenTypes::semicolon, "`;`");
+            auto statementCall = m_ArenaAllocator.allocate<node::StatementCall>();
+            statementCall->call = call.value();
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementCall;
+            return statement;
+        }
+        if (auto assgin = parseAssignment())
+        {
             trytoGetNextToken(TokenTypes::semicolon, "`;");
             auto statement = m_ArenaAllocator.allocate<node::Statement>();
-            statement->variant = assgin;
+            statement->variant = assgin.value();
             return statement;
         }
         if (lookAhead().has_value() && lookAhead().value().type == TokenTypes::open_curly)
@@ -322,6 +590,137 @@ public:
             statement->variant = statementIf;
             return statement;
         }
+        if (trytoGetNextToken(TokenTypes::_return))
+        {
+            auto statementReturn = m_ArenaAllocator.allocate<node::StatementReturn>();
+            if (const auto expr = parseExpr())
+            {
+                statementReturn->expr = expr.value();
+            }
+            else
+            {
+                logError("Expression");
+            }
+            trytoGetNextToken(TokenTypes::semicolon, "`;`");
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementReturn;
+            return statement;
+        }
+        if (trytoGetNextToken(TokenTypes::_while))
+        {
+            trytoGetNextToken(TokenTypes::open_parenthesis, "'('");
+            auto statementWhile = m_ArenaAllocator.allocate<node::StatementWhile>();
+            if (const auto expr = parseExpr())
+            {
+                statementWhile->expr = expr.value();
+            }
+            else
+            {
+                logError("Expression");
+            }
+
+            trytoGetNextToken(TokenTypes::close_parenthesis, "')'");
+            if (const auto scope = parseScope())
+            {
+                statementWhile->scope = scope.value();
+            }
+            else
+            {
+                logError("Scope");
+            }
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementWhile;
+            return statement;
+        }
+        if (trytoGetNextToken(TokenTypes::_for))
+        {
+            // for (let i = <Expr>; <Expr>; i = <Expr>) <Scope>
+            trytoGetNextToken(TokenTypes::open_parenthesis, "'('");
+            auto statementFor = m_ArenaAllocator.allocate<node::StatementFor>();
+            if (const auto init = parseLet())
+            {
+                statementFor->init = init.value();
+            }
+            else
+            {
+                logError("let statement");
+            }
+            if (const auto expr = parseExpr())
+            {
+                statementFor->expr = expr.value();
+            }
+            else
+            {
+                logError("Expression");
+            }
+            trytoGetNextToken(TokenTypes::semicolon, "`;`");
+            if (const auto step = parseAssignment())
+            {
+                statementFor->step = step.value();
+            }
+            else
+            {
+                logError("Assignment");
+            }
+
+            trytoGetNextToken(TokenTypes::close_parenthesis, "')'");
+            if (const auto scope = parseScope())
+            {
+                statementFor->scope = scope.value();
+            }
+            else
+            {
+                logError("Scope");
+            }
+            auto statement = m_ArenaAllocator.allocate<node::Statement>();
+            statement->variant = statementFor;
+            return statement;
+        }
+        return {};
+    }
+
+    // fn <Ident>(<Ident>, ...) <Scope>, only at the top level
+    std::optional<node::Function *> parseFunction()
+    {
+        if (!trytoGetNextToken(TokenTypes::fn))
+            return {};
+
+        auto function = m_ArenaAllocator.allocate<node::Function>();
+        function->ident = trytoGetNextToken(TokenTypes::ident, "function name");
+        trytoGetNextToken(TokenTypes::open_parenthesis, "`(`");
+        if (!trytoGetNextToken(TokenTypes::close_parenthesis))
+        {
+            do
+            {
+                function->params.push_back(trytoGetNextToken(TokenTypes::ident, "parameter name"));
+            } while (trytoGetNextToken(TokenTypes::comma));
+            trytoGetNextToken(TokenTypes::close_parenthesis, "`)`");
+        }
+        if (const auto scope = parseScope())
+        {
+            function->scope = scope.value();
+        }
+        else
+        {
+            logError("Scope");
+        }
+        return function;
+    }
+
+    // a top level function or statement
+    std::variant<node::Function *, node::Statement *> parseItem()
+    {
+        if (auto function = parseFunction())
+            return function.value();
+        if (auto statement = parseStatement())
+            return statement.value();
+        // parseProg takes the imports, a statement at a time compilation has nowhere to put them
+        if (trytoGetNextToken(TokenTypes::import))
+        {
+            std::cerr << "Error : Modules can't be imported in a statement at a time compilation" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        logError("Statement");
         return {};
     }
 
@@ -330,13 +729,17 @@ public:
         node::Prog prog;
         while (lookAhead().has_value())
         {
-            if (auto statement = parseStatement())
-                prog.statements.push_back(statement.value());
-
-            else
+            if (trytoGetNextToken(TokenTypes::import))
             {
-                logError("Statement");
+                prog.imports.push_back(trytoGetNextToken(TokenTypes::ident, "module name"));
+                trytoGetNextToken(TokenTypes::semicolon, "`;`");
+                continue;
             }
+            const auto item = parseItem();
+            if (const auto function = std::get_if<node::Function *>(&item))
+                prog.functions.push_back(*function);
+            else
+                prog.statements.push_back(std::get<node::Statement *>(item));
         }
         return prog;
     }
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <string>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <set>
+
+// a small line based optimizer that runs over the generated assembly,
+// the code generator is a simple stack machine, so most of the work here is to undo
+// the PUSH/POP round trips and to clean up the jumps emitted by the branch lowering
+class Peephole
+{
+private:
+    std::vector<std::string> m_Lines;
+
+    static std::string trim(const std::string &line)
+    {
+        const size_t begin = line.find_first_not_of(" \t");
+        if (begin == std::string::npos)
+            return "";
+        const size_t end = line.find_last_not_of(" \t");
+        return line.substr(begin, end - begin + 1);
+    }
+
+    static bool isLabel(const std::string &line)
+    {
+        const std::string s = trim(line);
+        return !s.empty() && s.back() == ':' && s.find(' ') == std::string::npos;
+    }
+
+    static std::string labelName(const std::string &line)
+    {
+        const std::string s = trim(line);
+        return s.substr(0, s.size() - 1);
+    }
+
+    // comments, directives and blank lines are transparent for the patterns below
+    static bool isInstruction(const std::string &line)
+    {
+        const std::string s = trim(line);
+        if (s.empty() || s[0] == ';' || s[0] == '%' || isLabel(line))
+            return false;
+        return line.starts_with("    ");
+    }
+
+    static std::string mnemonic(const std::string &line)
+    {
+        const std::string s = trim(line);
+        return s.substr(0, s.find(' '));
+    }
+
+    static std::string operands(const std::string &line)
+    {
+        const std::string s = trim(line);
+        const size_t space = s.find(' ');
+        if (space == std::string::npos)
+            return "";
+        return trim(s.substr(space + 1));
+    }
+
+    static bool isCondJump(const std::string &op)
+    {
+        return op.size() > 1 && op[0] == 'J' && op != "JMP";
+    }
+
+    // direct jumps only, `JMP [table + rax * 8]` is left alone
+    static bool isDirectJump(const std::string &line)
+    {
+        const std::string op = mnemonic(line);
+        return (op == "JMP" || isCondJump(op)) && operands(line).find('[') == std::string::npos;
+    }
+
+    static std::string invertCondJump(const std::string &op)
+    {
+        static const std::map<std::string, std::string> inverse = {
+            {"JZ", "JNZ"}, {"JNZ", "JZ"}, {"JE", "JNE"}, {"JNE", "JE"},
+            {"JB", "JAE"}, {"JAE", "JB"}, {"JA", "JBE"}, {"JBE", "JA"},
+            {"JL", "JGE"}, {"JGE", "JL"}, {"JG", "JLE"}, {"JLE", "JG"}};
+        const auto itr = inverse.find(op);
+        return itr == inverse.end() ? "" : itr->second;
+    }
+
+    // index of the next instruction or label after `index`, skipping the transparent lines
+    size_t next(size_t index) const
+    {
+        for (++index; index < m_Lines.size(); index++)
+            if (isInstruction(m_Lines[index]) || isLabel(m_Lines[index]))
+                return index;
+        return m_Lines.size();
+    }
+
+    // PUSH x followed by POP y is a plain move, and nothing at all if x == y
+    bool foldPushPop()
+    {
+        bool changed = false;
+        for (size_t i = 0; i < m_Lines.size(); i++)
+        {
+            if (!isInstruction(m_Lines[i]) || mnemonic(m_Lines[i]) != "PUSH")
+                continue;
+            const size_t j = next(i);
+            if (j == m_Lines.size() || !isInstruction(m_Lines[j]) || mnemonic(m_Lines[j]) != "POP")
+                continue;
+
+            const std::string src = operands(m_Lines[i]);
+            const std::string dst = operands(m_Lines[j]);
+            m_Lines[j].clear();
+            m_Lines[i] = src == dst ? "" : "    MOV " + dst + ", " + src;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // ADD, SUB, INC, DEC and NEG already set ZF from their result, the TEST right after them is redundant
+    bool dropRedundantTest()
+    {
+        bool changed = false;
+        for (size_t i = 0; i < m_Lines.size(); i++)
+        {
+            if (!isInstruction(m_Lines[i]))
+                continue;
+            const std::string op = mnemonic(m_Lines[i]);
+            if (op != "ADD" && op != "SUB" && op != "INC" && op != "DEC" && op != "NEG")
+                continue;
+            const std::string reg = operands(m_Lines[i]).substr(0, operands(m_Lines[i]).find(','));
+            if (reg == "rsp")
+                continue;
+            const size_t j = next(i);
+            if (j != m_Lines.size() && isInstruction(m_Lines[j]) && trim(m_Lines[j]) == "TEST " + reg + ", " + reg)
+            {
+                m_Lines[j].clear();
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // a label whose first instruction is `JMP x` can be replaced by x in every jump to it
+    bool threadJumps()
+    {
+        std::map<std::string, std::string> forward;
+        for (size_t i = 0; i < m_Lines.size(); i++)
+        {
+            if (!isLabel(m_Lines[i]))
+                continue;
+            size_t j = next(i);
+            while (j < m_Lines.size() && isLabel(m_Lines[j]))
+                j = next(j);
+            if (j < m_Lines.size() && mnemonic(m_Lines[j]) == "JMP" && isDirectJump(m_Lines[j]))
+                forward[labelName(m_Lines[i])] = operands(m_Lines[j]);
+        }
+
+        bool changed = false;
+        for (std::string &line : m_Lines)
+        {
+            if (!isInstruction(line) || !isDirectJump(line))
+                continue;
+            std::string target = operands(line);
+            std::set<std::string> visited{target};
+            while (forward.contains(target) && !visited.contains(forward[target]))
+            {
+                target = forward[target];
+                visited.insert(target);
+            }
+            if (target != operands(line))
+            {
+                line = "    " + mnemonic(line) + " " + target;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // `Jcc a; JMP b; a:` becomes `Jncc b; a:`, and a jump to the very next label is dropped
+    bool fallThrough()
+    {
+        bool changed = false;
+        for (size_t i = 0; i < m_Lines.size(); i++)
+        {
+            if (!isInstruction(m_Lines[i]) || !isDirectJump(m_Lines[i]))
+                continue;
+            const std::string op = mnemonic(m_Lines[i]);
+            const std::string target = operands(m_Lines[i]);
+
+            size_t j = next(i);
+            while (j < m_Lines.size() && isLabel(m_Lines[j]))
+            {
+                if (labelName(m_Lines[j]) == target)
+                {
+                    m_Lines[i].clear();
+                    changed = true;
+                    break;
+                }
+                j = next(j);
+            }
+            if (m_Lines[i].empty() || !isCondJump(op) || invertCondJump(op).empty())
+                continue;
+
+            j = next(i);
+            if (j == m_Lines.size() || !isInstruction(m_Lines[j]) || mnemonic(m_Lines[j]) != "JMP" || !isDirectJump(m_Lines[j]))
+                continue;
+            const size_t k = next(j);
+            if (k < m_Lines.size() && isLabel(m_Lines[k]) && labelName(m_Lines[k]) == target)
+            {
+                m_Lines[i] = "    " + invertCondJump(op) + " " + operands(m_Lines[j]);
+                m_Lines[j].clear();
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    // nothing after an unconditional jump is reachable until the next label
+    bool dropUnreachable()
+    {
+        bool changed = false;
+        for (size_t i = 0; i < m_Lines.size(); i++)
+        {
+            if (!isInstruction(m_Lines[i]) || mnemonic(m_Lines[i]) != "JMP")
+                continue;
+            for (size_t j = next(i); j < m_Lines.size() && !isLabel(m_Lines[j]); j = next(j))
+            {
+                m_Lines[j].clear();
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+public:
+    inline explicit Peephole(const std::string &assembly)
+    {
+        std::stringstream input(assembly);
+        std::string line;
+        while (std::getline(input, line))
+            m_Lines.push_back(line);
+    }
+
+    std::string optimize()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = foldPushPop();
+            changed |= dropRedundantTest();
+            changed |= threadJumps();
+            changed |= fallThrough();
+            changed |= dropUnreachable();
+        }
+
+        std::stringstream output;
+        for (const std::string &line : m_Lines)
+            if (!line.empty())
+                output << line << "\n";
+        return output.str();
+    }
+};
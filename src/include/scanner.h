@@ -1,15 +1,29 @@
 #pragma once
 
+#include "./simdSkip.h"
+
 inline std::optional<int> exprsPrecedence(const TokenTypes &type)
 {
     switch (type)
     {
+    case TokenTypes::or_or:
+        return 0;
+    case TokenTypes::and_and:
+        return 1;
+    case TokenTypes::eq_eq:
+    case TokenTypes::bang_eq:
+        return 2;
+    case TokenTypes::less:
+    case TokenTypes::less_eq:
+    case TokenTypes::greater:
+    case TokenTypes::greater_eq:
+        return 3;
     case TokenTypes::plus:
     case TokenTypes::sub:
-        return 0;
+        return 4;
     case TokenTypes::mul:
     case TokenTypes::div:
-        return 1;
+        return 5;
     default:
         return {};
     }
@@ -18,8 +32,9 @@ inline std::optional<int> exprsPrecedence(const TokenTypes &type)
 class Scanner
 {
 private:
-    const std::string m_Content;
+    const std::string_view m_Content; // the caller keeps the source alive, it can be a memory mapped file
     size_t m_Count;
+    int m_Line = 1;
 
     inline std::optional<char> lookAhead(const size_t ahead = 0) const
     {
@@ -34,13 +49,26 @@ private:
     }
 
 public:
-    inline explicit Scanner(const std::string &content) : m_Content(content), m_Count(0) {}
+    inline explicit Scanner(const std::string_view content) : m_Content(content), m_Count(0) {}
+
+    // everything in front of it has been turned into tokens already
+    inline size_t position() const
+    {
+        return m_Count;
+    }
 
     inline std::vector<Token> tokenize()
     {
         std::vector<Token> tokens;
+        while (const auto token = next())
+            tokens.push_back(token.value());
+        return tokens;
+    }
+
+    // the tokens are produced on demand, nothing but the current one is kept
+    inline std::optional<Token> next()
+    {
         std::string buf;
-        int countLine = 1;
 
         while (lookAhead().has_value())
         {
@@ -55,33 +83,47 @@ public:
 
                 if (buf == "exit")
                 {
-                    tokens.push_back({.type = TokenTypes::exit, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::exit, .line = m_Line};
                 }
                 else if (buf == "let")
                 {
-                    tokens.push_back({.type = TokenTypes::let, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::let, .line = m_Line};
                 }
                 else if (buf == "if")
                 {
-                    tokens.push_back({.type = TokenTypes::_if, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::_if, .line = m_Line};
                 }
                 else if (buf == "elif")
                 {
-                    tokens.push_back({.type = TokenTypes::elif, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::elif, .line = m_Line};
                 }
                 else if (buf == "else")
                 {
-                    tokens.push_back({.type = TokenTypes::_else, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::_else, .line = m_Line};
+                }
+                else if (buf == "while")
+                {
+                    return Token{.type = TokenTypes::_while, .line = m_Line};
+                }
+                else if (buf == "for")
+                {
+                    return Token{.type = TokenTypes::_for, .line = m_Line};
+                }
+                else if (buf == "fn")
+                {
+                    return Token{.type = TokenTypes::fn, .line = m_Line};
+                }
+                else if (buf == "return")
+                {
+                    return Token{.type = TokenTypes::_return, .line = m_Line};
+                }
+                else if (buf == "import")
+                {
+                    return Token{.type = TokenTypes::import, .line = m_Line};
                 }
                 else
                 {
-                    tokens.push_back({.type = TokenTypes::ident, .value = buf, .line = countLine});
-                    buf.clear();
+                    return Token{.type = TokenTypes::ident, .value = buf, .line = m_Line};
                 }
             }
             else if (std::isdigit(lookAhead().value()))
@@ -92,90 +134,136 @@ public:
                     buf.push_back(getNextChar());
                 }
 
-                tokens.push_back({.type = TokenTypes::int_literals, .value = buf, .line = countLine});
-                buf.clear();
+                return Token{.type = TokenTypes::int_literals, .value = buf, .line = m_Line};
             }
             else if (lookAhead().value() == '-' && lookAhead(1).has_value() && lookAhead(1).value() == '-')
             {
-                getNextChar();
-                getNextChar();
-                while (lookAhead().has_value() && lookAhead().value() != '\n')
-                    getNextChar();
+                // line comment, the newline itself is left for the whitespace skipping
+                m_Count = simd::findByte(m_Content.data(), m_Count + 2, m_Content.size(), '\n', m_Line);
             }
             else if (lookAhead().value() == '-' && lookAhead(1).has_value() && lookAhead(1).value() == '#')
             {
-                getNextChar();
-                getNextChar();
-                while (lookAhead().has_value())
-                {
-                    if (lookAhead().value() == '#' && lookAhead(1).has_value() && lookAhead(1).value() == '-')
-                        break;
-                    getNextChar();
-                }
-
-                if (lookAhead().has_value())
-                    getNextChar();
-
-                if (lookAhead().has_value())
-                    getNextChar();
+                m_Count = simd::skipBlockComment(m_Content.data(), m_Count + 2, m_Content.size(), m_Line);
             }
             else if (lookAhead().value() == '(')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::open_parenthesis, .line = countLine});
+                return Token{.type = TokenTypes::open_parenthesis, .line = m_Line};
             }
             else if (lookAhead().value() == ')')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::close_parenthesis, .line = countLine});
+                return Token{.type = TokenTypes::close_parenthesis, .line = m_Line};
+            }
+            else if (lookAhead().value() == '[')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::open_bracket, .line = m_Line};
+            }
+            else if (lookAhead().value() == ']')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::close_bracket, .line = m_Line};
+            }
+            else if (lookAhead().value() == ',')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::comma, .line = m_Line};
             }
             else if (lookAhead().value() == ';')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::semicolon, .line = countLine});
+                return Token{.type = TokenTypes::semicolon, .line = m_Line};
+            }
+            else if (lookAhead().value() == '=' && lookAhead(1).has_value() && lookAhead(1).value() == '=')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::eq_eq, .line = m_Line};
+            }
+            else if (lookAhead().value() == '!' && lookAhead(1).has_value() && lookAhead(1).value() == '=')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::bang_eq, .line = m_Line};
+            }
+            else if (lookAhead().value() == '<' && lookAhead(1).has_value() && lookAhead(1).value() == '=')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::less_eq, .line = m_Line};
+            }
+            else if (lookAhead().value() == '>' && lookAhead(1).has_value() && lookAhead(1).value() == '=')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::greater_eq, .line = m_Line};
+            }
+            else if (lookAhead().value() == '&' && lookAhead(1).has_value() && lookAhead(1).value() == '&')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::and_and, .line = m_Line};
+            }
+            else if (lookAhead().value() == '|' && lookAhead(1).has_value() && lookAhead(1).value() == '|')
+            {
+                getNextChar();
+                getNextChar();
+                return Token{.type = TokenTypes::or_or, .line = m_Line};
+            }
+            else if (lookAhead().value() == '<')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::less, .line = m_Line};
+            }
+            else if (lookAhead().value() == '>')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::greater, .line = m_Line};
+            }
+            else if (lookAhead().value() == '!')
+            {
+                getNextChar();
+                return Token{.type = TokenTypes::bang, .line = m_Line};
             }
             else if (lookAhead().value() == '=')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::eq, .line = countLine});
+                return Token{.type = TokenTypes::eq, .line = m_Line};
             }
             else if (lookAhead().value() == '+')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::plus, .line = countLine});
+                return Token{.type = TokenTypes::plus, .line = m_Line};
             }
             else if (lookAhead().value() == '*')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::mul, .line = countLine});
+                return Token{.type = TokenTypes::mul, .line = m_Line};
             }
             else if (lookAhead().value() == '-')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::sub, .line = countLine});
+                return Token{.type = TokenTypes::sub, .line = m_Line};
             }
             else if (lookAhead().value() == '/')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::div, .line = countLine});
+                return Token{.type = TokenTypes::div, .line = m_Line};
             }
             else if (lookAhead().value() == '{')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::open_curly, .line = countLine});
+                return Token{.type = TokenTypes::open_curly, .line = m_Line};
             }
             else if (lookAhead().value() == '}')
             {
                 getNextChar();
-                tokens.push_back({.type = TokenTypes::close_curly, .line = countLine});
-            }
-            else if (lookAhead().value() == '\n'){
-                getNextChar();
-                countLine ++;
+                return Token{.type = TokenTypes::close_curly, .line = m_Line};
             }
             else if (std::isspace(lookAhead().value()))
             {
-                getNextChar();
+                m_Count = simd::skipWhitespace(m_Content.data(), m_Count, m_Content.size(), m_Line);
             }
             else
             {
@@ -183,7 +271,6 @@ public:
                 exit(EXIT_FAILURE);
             }
         }
-        m_Count = 0;
-        return tokens;
+        return {};
     }
 };
\ No newline at end of file
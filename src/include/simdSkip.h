@@ -0,0 +1,167 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BLUE_SIMD_X86 1
+#endif
+
+// fast paths for the parts of the source the scanner throws away: whitespace and comments.
+// each function starts at pos and returns the position of the first byte it doesn't skip,
+// the newlines it skips over are added to lines so the line numbers of the tokens stay exact.
+// the vector versions are picked at runtime, AVX2 when the cpu has it, SSE2 otherwise, with
+// a scalar fallback for other targets and for the tail of the input
+namespace simd
+{
+    inline bool isSpace(const char c)
+    {
+        // same set as std::isspace in the C locale: ' ', \t, \n, \v, \f, \r
+        return c == ' ' || (static_cast<unsigned char>(c) - 9u) <= 4u;
+    }
+
+    inline size_t skipWhitespaceScalar(const char *data, size_t pos, const size_t size, int &lines)
+    {
+        for (; pos < size && isSpace(data[pos]); pos++)
+            lines += data[pos] == '\n';
+        return pos;
+    }
+
+    inline size_t findByteScalar(const char *data, size_t pos, const size_t size, const char byte, int &lines)
+    {
+        for (; pos < size && data[pos] != byte; pos++)
+            lines += data[pos] == '\n';
+        return pos;
+    }
+
+#ifdef BLUE_SIMD_X86
+    // bit i of the result is set when byte i is whitespace
+    inline uint32_t spaceMask(const __m128i chunk)
+    {
+        const __m128i shifted = _mm_sub_epi8(chunk, _mm_set1_epi8(9));
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+        const __m128i space = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+        return _mm_movemask_epi8(_mm_or_si128(control, space));
+    }
+
+    inline size_t skipWhitespaceSse2(const char *data, size_t pos, const size_t size, int &lines)
+    {
+        for (; pos + 16 <= size; pos += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+            const uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+            const uint32_t other = ~spaceMask(chunk) & 0xffff;
+            if (other)
+            {
+                // only the newlines in front of the first byte we stop at count
+                const unsigned stop = std::countr_zero(other);
+                lines += std::popcount(newlines & ((1u << stop) - 1));
+                return pos + stop;
+            }
+            lines += std::popcount(newlines);
+        }
+        return skipWhitespaceScalar(data, pos, size, lines);
+    }
+
+    inline size_t findByteSse2(const char *data, size_t pos, const size_t size, const char byte, int &lines)
+    {
+        for (; pos + 16 <= size; pos += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+            const uint32_t newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+            const uint32_t found = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(byte)));
+            if (found)
+            {
+                const unsigned stop = std::countr_zero(found);
+                lines += std::popcount(newlines & ((1u << stop) - 1));
+                return pos + stop;
+            }
+            lines += std::popcount(newlines);
+        }
+        return findByteScalar(data, pos, size, byte, lines);
+    }
+
+    __attribute__((target("avx2"))) inline uint32_t spaceMaskAvx2(const __m256i chunk)
+    {
+        const __m256i shifted = _mm256_sub_epi8(chunk, _mm256_set1_epi8(9));
+        const __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+        const __m256i space = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+        return _mm256_movemask_epi8(_mm256_or_si256(control, space));
+    }
+
+    __attribute__((target("avx2"))) inline size_t skipWhitespaceAvx2(const char *data, size_t pos, const size_t size, int &lines)
+    {
+        for (; pos + 32 <= size; pos += 32)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+            const uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+            const uint32_t other = ~spaceMaskAvx2(chunk);
+            if (other)
+            {
+                const unsigned stop = std::countr_zero(other);
+                lines += std::popcount(newlines & ((uint64_t{1} << stop) - 1));
+                return pos + stop;
+            }
+            lines += std::popcount(newlines);
+        }
+        return skipWhitespaceSse2(data, pos, size, lines);
+    }
+
+    __attribute__((target("avx2"))) inline size_t findByteAvx2(const char *data, size_t pos, const size_t size, const char byte, int &lines)
+    {
+        for (; pos + 32 <= size; pos += 32)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+            const uint32_t newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+            const uint32_t found = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(byte)));
+            if (found)
+            {
+                const unsigned stop = std::countr_zero(found);
+                lines += std::popcount(newlines & ((uint64_t{1} << stop) - 1));
+                return pos + stop;
+            }
+            lines += std::popcount(newlines);
+        }
+        return findByteSse2(data, pos, size, byte, lines);
+    }
+
+    inline bool hasAvx2()
+    {
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2;
+    }
+#endif
+
+    inline size_t skipWhitespace(const char *data, const size_t pos, const size_t size, int &lines)
+    {
+#ifdef BLUE_SIMD_X86
+        return hasAvx2() ? skipWhitespaceAvx2(data, pos, size, lines) : skipWhitespaceSse2(data, pos, size, lines);
+#else
+        return skipWhitespaceScalar(data, pos, size, lines);
+#endif
+    }
+
+    // position of the next `byte`, or size if there is none
+    inline size_t findByte(const char *data, const size_t pos, const size_t size, const char byte, int &lines)
+    {
+#ifdef BLUE_SIMD_X86
+        return hasAvx2() ? findByteAvx2(data, pos, size, byte, lines) : findByteSse2(data, pos, size, byte, lines);
+#else
+        return findByteScalar(data, pos, size, byte, lines);
+#endif
+    }
+
+    // pos is right after the opening `-#`, returns the position after the closing `#-`, or size if it's missing
+    inline size_t skipBlockComment(const char *data, size_t pos, const size_t size, int &lines)
+    {
+        while ((pos = findByte(data, pos, size, '#', lines)) < size)
+        {
+            if (pos + 1 < size && data[pos + 1] == '-')
+                return pos + 2;
+            pos++;
+        }
+        return size;
+    }
+}
@@ -20,7 +20,24 @@ enum class TokenTypes
     sub,
     _if,
     elif,
-    _else
+    _else,
+    eq_eq,
+    bang_eq,
+    less,
+    less_eq,
+    greater,
+    greater_eq,
+    and_and,
+    or_or,
+    bang,
+    _while,
+    _for,
+    fn,
+    _return,
+    comma,
+    open_bracket,
+    close_bracket,
+    import
 };
 
 struct Token
@@ -1,22 +1,191 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <set>
 #include <vector>
 #include "./include/codeGenerator.h"
 #include "./include/scanner.h"
+#include "./include/evaluator.h"
+#include "./include/interpreter.h"
+#include "./include/moduleGraph.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// the assembly of a module, the functions of the modules it imports are external
+static std::string genModule(const ModuleGraph &modules, const Module &module, GeneratorOptions options)
+{
+    options.exports = true;
+    options.library = &module != &modules.root();
+    if (!options.debugFile.empty())
+        options.debugFile = module.path.string();
+    CodeGenerator generator(module.prog, options);
+    for (const node::Function *function : modules.imported(module))
+        generator.importFunction(function);
+    return generator.genProg();
+}
+
+// the options that change the code of an object, written next to it to ../<name>.flags
+static std::string objectFlags(const GeneratorOptions &options)
+{
+    std::string flags;
+    if (!options.debugFile.empty())
+        flags += "-g\n";
+    if (options.avx2)
+        flags += "-mavx2\n";
+    if (options.profileGenerate)
+        flags += "--profile-generate\n";
+    for (const uint64_t counter : options.profile)
+        flags += std::to_string(counter) + "\n";
+    return flags;
+}
+
+// every module is compiled to an object of its own, ../<name>.o, unless it's up to date, then they are linked to ../out
+static bool buildObjects(const ModuleGraph &modules, const GeneratorOptions &options)
+{
+    const std::string flags = objectFlags(options);
+    // a compile error exits, which can't happen on a worker while the others still run: the modules that
+    // are out of date are checked here first, the workers only compile the ones that are known to compile
+    std::set<const Module *> stale;
+    for (const auto &module : modules.modules())
+        if (!modules.isUpToDate(*module, "../" + module->name + ".o", flags))
+        {
+            GeneratorOptions checkOptions = options;
+            checkOptions.checkOnly = true;
+            genModule(modules, *module, checkOptions);
+            stale.insert(module.get());
+        }
+
+    const bool built = modules.build([&](const Module &module)
+                                     {
+        if (!stale.contains(&module))
+            return true;
+        std::ofstream("../" + module.name + ".asm") << genModule(modules, module, options);
+        const std::string nasm = options.debugFile.empty() ? "cd ../ && nasm -felf64 " : "cd ../ && nasm -felf64 -g -F dwarf ";
+        if (system((nasm + module.name + ".asm").c_str()) != 0)
+            return false;
+        // only once the object is there, an object left from other options never matches them
+        std::ofstream("../" + module.name + ".flags") << flags;
+        return true; },
+                                     std::thread::hardware_concurrency());
+    if (!built)
+        return false;
+
+    std::string link = "cd ../ && ld -o out";
+    for (const auto &module : modules.modules())
+        link += " " + module->name + ".o";
+    return system(link.c_str()) == 0;
+}
 
 int main(int argc, char const *argv[])
 {
-    if (argc != 2)
+    GeneratorOptions options;
+    std::optional<std::string> filename;
+    bool stream = false;
+    bool interp = false;
+    bool emitObject = false;
+    std::optional<uint64_t> evalSteps;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-g")
+        {
+            options.debugFile = "-";
+        }
+        else if (arg == "--stream")
+        {
+            stream = true;
+        }
+        else if (arg == "--interp")
+        {
+            interp = true;
+        }
+        else if (arg == "--emit=obj")
+        {
+            emitObject = true;
+        }
+        else if (arg == "--eval")
+        {
+            evalSteps = Evaluator::s_StepBudget;
+        }
+        else if (arg.starts_with("--eval="))
+        {
+            evalSteps = std::strtoull(arg.c_str() + std::string("--eval=").size(), nullptr, 10);
+        }
+        else if (arg == "-mavx2")
+        {
+            options.avx2 = true;
+        }
+        else if (arg == "--profile-generate")
+        {
+            options.profileGenerate = true;
+        }
+        else if (arg.starts_with("--profile-use="))
+        {
+            std::ifstream profile(arg.substr(std::string("--profile-use=").size()), std::ios::binary);
+            if (!profile.is_open())
+            {
+                std::cerr << "Error: unable to open the profile." << std::endl;
+                return EXIT_FAILURE;
+            }
+            uint64_t counter;
+            while (profile.read(reinterpret_cast<char *>(&counter), sizeof(counter)))
+                options.profile.push_back(counter);
+        }
+        else if (!arg.starts_with("--") && !filename.has_value())
+        {
+            filename = arg;
+        }
+        else
+        {
+            filename.reset();
+            break;
+        }
+    }
+
+    // --stream, --interp and --emit=obj exclude each other and the profile flags
+    const int modes = stream + interp + emitObject;
+    if (!filename.has_value() || modes > 1 || (modes && (options.profileGenerate || !options.profile.empty() || evalSteps.has_value())) ||
+        (evalSteps.has_value() && options.profileGenerate))
     {
-        std::cerr << "Error : Invalid Usage blue <filename>" << std::endl;
+        std::cerr << "Error : Invalid Usage blue [-g] [-mavx2] [--eval[=<steps>]] [--stream | --interp | --emit=obj | --profile-generate | --profile-use=<file>] <filename>" << std::endl;
         return EXIT_FAILURE;
     }
 
+    if (!options.debugFile.empty())
+        options.debugFile = filename.value();
+    options.checkOnly = interp;
+
     std::string contents;
+    std::string_view source;
+    if (stream)
+    {
+        // the source is mapped instead of read, the pages the scanner is done with can be dropped by the kernel
+        const int fd = open(filename.value().c_str(), O_RDONLY);
+        struct stat info{};
+        if (fd < 0 || fstat(fd, &info) < 0)
+        {
+            std::cerr << "Error: unable to open a file for writing." << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (info.st_size > 0)
+        {
+            void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                std::cerr << "Error: unable to map the file." << std::endl;
+                return EXIT_FAILURE;
+            }
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            source = std::string_view(static_cast<const char *>(data), info.st_size);
+        }
+        close(fd);
+    }
+    else
     {
         std::stringstream buf;
-        std::ifstream input(argv[1]);
+        std::ifstream input(filename.value());
         if (!input.is_open())
         {
             std::cerr << "Error: unable to open a file for writing." << std::endl;
@@ -24,27 +193,73 @@ int main(int argc, char const *argv[])
         }
         buf << input.rdbuf();
         contents = buf.str();
+        source = contents;
+        std::cout << contents << std::endl;
     }
-    std::cout << contents << std::endl;
-    Scanner sc(contents);
-    std::vector<Token> tokens = sc.tokenize();
-
-    Parser parser(tokens);
-    std::optional<node::Prog> prog = parser.parseProg();
+    Scanner sc(source);
+    Parser parser(sc);
 
-    if (!prog.has_value())
+    if (stream)
     {
-        std::cerr << "Error : Invalid program" << std::endl;
-        exit(EXIT_FAILURE);
+        // only the statement being compiled is in memory, the inlined functions are kept for their call sites
+        CodeGenerator generator({}, options);
+        std::ofstream write("../out.asm");
+        generator.beginStream(write);
+        // the tokens own their text, the pages of the source the scanner has gone past aren't needed anymore
+        const size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t released = 0;
+        while (parser.hasMore())
+        {
+            if (const size_t done = sc.position() / pageSize * pageSize; done > released)
+            {
+                madvise(const_cast<char *>(source.data()) + released, done - released, MADV_DONTNEED);
+                released = done;
+            }
+            const auto mark = parser.mark();
+            const auto item = parser.parseItem();
+            if (const auto function = std::get_if<node::Function *>(&item))
+            {
+                if (!generator.streamFunction(*function))
+                    parser.rewind(mark);
+            }
+            else
+            {
+                generator.streamStatement(std::get<node::Statement *>(item));
+                parser.rewind(mark);
+            }
+        }
+        generator.endStream();
     }
-
+    else
     {
-        CodeGenerator generator(prog.value());
+        std::optional<node::Prog> prog = parser.parseProg();
+
+        if (!prog.has_value())
+        {
+            std::cerr << "Error : Invalid program" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+
+        const ModuleGraph modules(filename.value(), prog.value());
+        if (emitObject)
+            return buildObjects(modules, options) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        // otherwise the imported functions are compiled along with the program, they can be inlined then
+        const node::Prog program = modules.merged();
+        CodeGenerator generator(program, options);
+        std::string output = generator.genProg();
+        // the generator has checked the program, it runs without assembling or linking anything
+        if (interp)
+            return static_cast<int>(Interpreter(BytecodeCompiler(program).compile()).run() & 0xff);
+        // the generator has checked the program, if it also finishes at compile time only its exit code is left
+        if (evalSteps.has_value())
+            if (const auto code = Evaluator(program, evalSteps.value()).run())
+                output = CodeGenerator::genConstantProg(code.value());
         std::ofstream write("../out.asm");
-        write << generator.genProg();
+        write << output;
     }
 
-    system("cd ../ && nasm -felf64 out.asm");
+    system(options.debugFile.empty() ? "cd ../ && nasm -felf64 out.asm" : "cd ../ && nasm -felf64 -g -F dwarf out.asm");
     system("cd ../ && ld -o out out.o");
 
     return EXIT_SUCCESS;
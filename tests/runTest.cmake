@@ -0,0 +1,37 @@
+# cmake -DBLUE=<blue> -DPROGRAM=<file.bl> -DMODE=<mode> -DWORK=<dir> (-DEXIT=<code> | -DERROR=<message>) -P runTest.cmake
+# the driver writes ../out.asm and links ../out, so it runs in WORK/build
+set(native_flags "")
+set(stream_flags --stream)
+set(interp_flags --interp)
+set(eval_flags --eval)
+set(evalBudget_flags --eval=1000) # a budget the longer programs run out of
+set(avx2_flags -mavx2)
+set(obj_flags --emit=obj)
+
+file(REMOVE_RECURSE ${WORK})
+file(MAKE_DIRECTORY ${WORK}/build)
+execute_process(COMMAND ${BLUE} ${${MODE}_flags} ${PROGRAM}
+    WORKING_DIRECTORY ${WORK}/build
+    RESULT_VARIABLE compiled
+    OUTPUT_QUIET
+    ERROR_VARIABLE errors)
+
+if(ERROR)
+    string(FIND "${errors}" "${ERROR}" found)
+    if(compiled EQUAL 0 OR found EQUAL -1)
+        message(FATAL_ERROR "expected the compile error `${ERROR}`, got ${compiled} : ${errors}")
+    endif()
+    return()
+endif()
+
+# --interp runs the program itself, the others leave a binary behind
+if(MODE STREQUAL "interp")
+    set(code ${compiled})
+elseif(NOT EXISTS ${WORK}/out)
+    message(FATAL_ERROR "didn't build : ${errors}")
+else()
+    execute_process(COMMAND ${WORK}/out RESULT_VARIABLE code TIMEOUT 10)
+endif()
+if(NOT code STREQUAL EXIT)
+    message(FATAL_ERROR "expected exit code ${EXIT}, got ${code} : ${errors}")
+endif()
@@ -0,0 +1,71 @@
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "../src/include/simdSkip.h"
+
+// the vector skipping has to agree with the scalar one, on the position it stops at and on the newlines it
+// counts, from every start offset: the vectors then cover every alignment and every split of the input into
+// full vectors and a scalar tail
+
+using Skip = size_t (*)(const char *data, size_t pos, size_t size, int &lines);
+
+static bool agree(const std::string &input, const char *what, const Skip skip, const Skip scalar)
+{
+    bool passed = true;
+    for (size_t start = 0; start <= input.size(); start++)
+    {
+        int expectedLines = 0, lines = 0;
+        const size_t expected = scalar(input.data(), start, input.size(), expectedLines);
+        const size_t pos = skip(input.data(), start, input.size(), lines);
+        if (pos == expected && lines == expectedLines)
+            continue;
+        std::cerr << what << " from " << start << " stops at " << pos << " after " << lines << " newlines, the scalar version at "
+                  << expected << " after " << expectedLines << " : `" << input << "`" << std::endl;
+        passed = false;
+    }
+    return passed;
+}
+
+// findByte looks for the # that ends a block comment
+template <auto FindByte>
+static size_t findHash(const char *data, const size_t pos, const size_t size, int &lines)
+{
+    return FindByte(data, pos, size, '#', lines);
+}
+
+static bool checkInput(const std::string &input)
+{
+    bool passed = agree(input, "skipWhitespace", simd::skipWhitespace, simd::skipWhitespaceScalar);
+    passed &= agree(input, "findByte", findHash<simd::findByte>, findHash<simd::findByteScalar>);
+#ifdef BLUE_SIMD_X86
+    passed &= agree(input, "skipWhitespaceSse2", simd::skipWhitespaceSse2, simd::skipWhitespaceScalar);
+    passed &= agree(input, "findByteSse2", findHash<simd::findByteSse2>, findHash<simd::findByteScalar>);
+    if (simd::hasAvx2())
+    {
+        passed &= agree(input, "skipWhitespaceAvx2", simd::skipWhitespaceAvx2, simd::skipWhitespaceScalar);
+        passed &= agree(input, "findByteAvx2", findHash<simd::findByteAvx2>, findHash<simd::findByteScalar>);
+    }
+#endif
+    return passed;
+}
+
+int main()
+{
+    // every whitespace byte, the bytes next to them that aren't, and the byte findByte looks for
+    static constexpr char s_Alphabet[] = {' ', '\t', '\n', '\v', '\f', '\r', '\b', '\x0e', '!', 'a', '#', '\x80', '\xff'};
+    std::mt19937 random(1);
+    bool passed = true;
+    for (size_t length = 0; length <= 100; length++)
+        for (size_t sample = 0; sample < 20; sample++)
+        {
+            // mostly whitespace, so the skipping runs over whole vectors before it stops
+            std::string input;
+            const unsigned density = random() % 4 + 1;
+            for (size_t i = 0; i < length; i++)
+                input += random() % 16 < density ? s_Alphabet[random() % std::size(s_Alphabet)] : s_Alphabet[random() % 6];
+            passed &= checkInput(input);
+        }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// measures the code blue generates for a corpus of programs: static metrics of the assembly and the binary,
+// and the hardware counters of running the binary, of compiling the program and of running it on the
+// interpreter. the results go to perf-results.json and are compared to a baseline, a metric that got worse
+// by more than its tolerance fails the run. every metric is better lower. the counters depend on the
+// machine, so the baseline is recorded per machine with --update
+
+struct Metric
+{
+    const char *name;
+    double tolerance; // relative
+};
+
+static constexpr Metric s_Metrics[] = {
+    {"codeSize", 0.0},           // bytes of the executable sections
+    {"staticInstructions", 0.0}, // instructions in the assembly
+    {"pushPop", 0.0},            // PUSH and POP instructions in the assembly
+    {"memoryOperands", 0.0},     // instructions with a memory operand, LEA aside
+    {"instructions", 0.02},
+    {"cycles", 0.10},
+    {"branchMisses", 0.20},
+    {"l1dMisses", 0.20},
+    {"compileInstructions", 0.02}, // blue itself, nasm and ld aside
+    {"compileCycles", 0.10},
+    {"interpInstructions", 0.02}, // blue --interp, the compile included
+    {"interpCycles", 0.10},
+};
+
+// program -> metric -> value, a counter the kernel doesn't give us is null
+using Results = std::map<std::string, std::map<std::string, std::optional<uint64_t>>>;
+
+static int openCounter(const pid_t pid, const uint32_t type, const uint64_t config)
+{
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1; // only the binary is counted, not the fork and exec around it
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0));
+}
+
+struct Run
+{
+    int exitCode; // 128 + the signal when it was killed, like the shell reports it
+    std::map<std::string, std::optional<uint64_t>> counters{};
+};
+
+// runs argv in dir with its output discarded. the child waits on a pipe until the counters are attached
+// to it, they start counting at its exec and don't follow the processes it starts
+static Run run(const std::vector<std::string> &argv, const std::filesystem::path &dir)
+{
+    int ready[2];
+    if (pipe(ready) < 0)
+    {
+        std::cerr << "Error : pipe failed" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(ready[1]);
+        std::vector<char *> args;
+        for (const std::string &arg : argv)
+            args.push_back(const_cast<char *>(arg.c_str()));
+        args.push_back(nullptr);
+        const int null = open("/dev/null", O_WRONLY);
+        char go;
+        if (chdir(dir.c_str()) == 0 && null >= 0 && dup2(null, STDOUT_FILENO) >= 0 && read(ready[0], &go, 1) == 1)
+            execv(args[0], args.data());
+        _exit(127);
+    }
+    close(ready[0]);
+
+    const std::pair<const char *, std::pair<uint32_t, uint64_t>> events[] = {
+        {"instructions", {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS}},
+        {"cycles", {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES}},
+        {"branchMisses", {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES}},
+        {"l1dMisses", {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}},
+    };
+    std::vector<std::pair<std::string, int>> counters;
+    for (const auto &[name, event] : events)
+        counters.emplace_back(name, openCounter(pid, event.first, event.second));
+
+    // the child exits without running anything when it doesn't get the byte, the counters then see nothing
+    if (write(ready[1], "x", 1) != 1)
+    {
+        std::cerr << "Error : can't start " << argv[0] << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    close(ready[1]);
+    int status;
+    waitpid(pid, &status, 0);
+
+    Run result{.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)};
+    for (const auto &[name, fd] : counters)
+    {
+        uint64_t value;
+        if (fd >= 0 && read(fd, &value, sizeof(value)) == sizeof(value))
+            result.counters[name] = value;
+        else
+            result.counters[name] = std::nullopt;
+        if (fd >= 0)
+            close(fd);
+    }
+    return result;
+}
+
+// the bytes of the executable sections of an ELF64 binary
+static uint64_t codeSize(const std::string &binary)
+{
+    std::ifstream input(binary, std::ios::binary);
+    const std::string elf((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    Elf64_Ehdr header;
+    if (elf.size() < sizeof(header) || elf.compare(0, SELFMAG, ELFMAG) != 0)
+    {
+        std::cerr << "Error : Not an ELF binary : " << binary << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::memcpy(&header, elf.data(), sizeof(header));
+    uint64_t size = 0;
+    for (size_t i = 0; i < header.e_shnum; i++)
+    {
+        Elf64_Shdr section;
+        std::memcpy(&section, elf.data() + header.e_shoff + i * header.e_shentsize, sizeof(section));
+        if (section.sh_flags & SHF_EXECINSTR)
+            size += section.sh_size;
+    }
+    return size;
+}
+
+// an instruction line of the generated assembly is indented by four spaces, like the code generator writes it
+static void countInstructions(const std::string &assembly, std::map<std::string, std::optional<uint64_t>> &metrics)
+{
+    std::ifstream input(assembly);
+    uint64_t total = 0, pushPop = 0, memoryOperands = 0;
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (!line.starts_with("    ") || line.size() <= 4 || !std::isalpha(line[4]))
+            continue;
+        const std::string mnemonic = line.substr(4, line.find(' ', 4) - 4);
+        total++;
+        pushPop += mnemonic == "PUSH" || mnemonic == "POP";
+        memoryOperands += mnemonic != "LEA" && line.find('[') != std::string::npos;
+    }
+    metrics["staticInstructions"] = total;
+    metrics["pushPop"] = pushPop;
+    metrics["memoryOperands"] = memoryOperands;
+}
+
+// the counters of the compiler's or the interpreter's run: instructions -> compileInstructions
+static void addCounters(std::map<std::string, std::optional<uint64_t>> &metrics, const std::string &prefix, const Run &result)
+{
+    for (const auto &[name, value] : result.counters)
+    {
+        const std::string metric = prefix + static_cast<char>(std::toupper(name[0])) + name.substr(1);
+        if (std::ranges::any_of(s_Metrics, [&](const Metric &known)
+                                { return metric == known.name; }))
+            metrics[metric] = value;
+    }
+}
+
+// the driver writes ../out.asm and links ../out, so every program gets a directory of its own. the binary runs
+// `runs` times, the compiler and the interpreter once: their runs are long enough to not need it
+static std::map<std::string, std::optional<uint64_t>> measure(const std::filesystem::path &program, const size_t runs)
+{
+    const std::filesystem::path dir = std::filesystem::absolute("perf") / program.stem();
+    std::filesystem::create_directories(dir / "build");
+    std::filesystem::remove(dir / "out");
+    const std::string source = std::filesystem::absolute(program).string();
+    const Run compiled = run({BLUE_EXECUTABLE, source}, dir / "build");
+    if (compiled.exitCode != 0 || !std::filesystem::exists(dir / "out"))
+    {
+        std::cerr << "Error : " << program.string() << " didn't build" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    std::map<std::string, std::optional<uint64_t>> metrics;
+    metrics["codeSize"] = codeSize((dir / "out").string());
+    countInstructions((dir / "out.asm").string(), metrics);
+    addCounters(metrics, "compile", compiled);
+    // the fastest run is the one with the least noise in it
+    for (size_t i = 0; i < runs; i++)
+    {
+        const Run result = run({(dir / "out").string()}, dir);
+        if (i > 0 && metrics["exitCode"] != static_cast<uint64_t>(result.exitCode))
+        {
+            std::cerr << "Error : " << program.string() << " exits with a different code from run to run" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        metrics["exitCode"] = result.exitCode;
+        for (const auto &[name, value] : result.counters)
+            if (i == 0 || (value.has_value() && metrics[name].has_value()))
+                metrics[name] = i == 0 ? value : std::min(value.value(), metrics[name].value());
+    }
+
+    // the same program on the interpreter, the difference to the binary is the cost of its dispatch
+    const Run interpreted = run({BLUE_EXECUTABLE, "--interp", source}, dir / "build");
+    if (metrics["exitCode"] != static_cast<uint64_t>(interpreted.exitCode))
+    {
+        std::cerr << "Error : " << program.string() << " exits with " << interpreted.exitCode << " on the interpreter, "
+                  << metrics["exitCode"].value() << " natively" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    addCounters(metrics, "interp", interpreted);
+    if (metrics["cycles"].has_value() && metrics["interpCycles"].has_value())
+        std::cout << program.stem().string() << " : the interpreter takes " << static_cast<double>(metrics["interpCycles"].value()) / static_cast<double>(metrics["cycles"].value())
+                  << "x the cycles of the binary" << std::endl;
+    return metrics;
+}
+
+static void writeResults(const std::string &path, const Results &results)
+{
+    std::ofstream output(path);
+    output << "{\n";
+    for (auto program = results.begin(); program != results.end(); program++)
+    {
+        output << "  \"" << program->first << "\": {";
+        for (auto metric = program->second.begin(); metric != program->second.end(); metric++)
+        {
+            output << (metric == program->second.begin() ? "" : ", ") << "\"" << metric->first << "\": ";
+            if (metric->second.has_value())
+                output << metric->second.value();
+            else
+                output << "null";
+        }
+        output << "}" << (std::next(program) == results.end() ? "" : ",") << "\n";
+    }
+    output << "}\n";
+}
+
+// only the shape writeResults produces: an object of objects of numbers and nulls
+class ResultsReader
+{
+private:
+    const std::string m_Text;
+    size_t m_Pos = 0;
+
+    void expect(const char c)
+    {
+        m_Pos = m_Text.find_first_not_of(" \t\r\n", m_Pos);
+        if (m_Pos == std::string::npos || m_Text[m_Pos] != c)
+        {
+            std::cerr << "Error : Invalid baseline, expected `" << c << "`" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        m_Pos++;
+    }
+
+    bool accept(const char c)
+    {
+        m_Pos = m_Text.find_first_not_of(" \t\r\n", m_Pos);
+        if (m_Pos == std::string::npos || m_Text[m_Pos] != c)
+            return false;
+        m_Pos++;
+        return true;
+    }
+
+    std::string string()
+    {
+        expect('"');
+        const size_t end = m_Text.find('"', m_Pos);
+        std::string value = m_Text.substr(m_Pos, end - m_Pos);
+        m_Pos = end + 1;
+        return value;
+    }
+
+    std::optional<uint64_t> number()
+    {
+        m_Pos = m_Text.find_first_not_of(" \t\r\n", m_Pos);
+        if (m_Text.compare(m_Pos, 4, "null") == 0)
+        {
+            m_Pos += 4;
+            return {};
+        }
+        size_t length = 0;
+        const uint64_t value = std::stoull(m_Text.substr(m_Pos), &length);
+        m_Pos += length;
+        return value;
+    }
+
+public:
+    inline explicit ResultsReader(std::string text) : m_Text(std::move(text)) {}
+
+    Results read()
+    {
+        Results results;
+        expect('{');
+        if (accept('}'))
+            return results;
+        do
+        {
+            auto &metrics = results[string()];
+            expect(':');
+            expect('{');
+            if (accept('}'))
+                continue;
+            do
+            {
+                const std::string name = string();
+                expect(':');
+                metrics[name] = number();
+            } while (accept(','));
+            expect('}');
+        } while (accept(','));
+        expect('}');
+        return results;
+    }
+};
+
+// a changed exit code means the generated code is wrong, not slower
+static bool compare(const Results &baseline, const Results &results)
+{
+    bool passed = true;
+    for (const auto &[program, metrics] : results)
+    {
+        const auto base = baseline.find(program);
+        if (base == baseline.end())
+        {
+            std::cout << program << " : not in the baseline" << std::endl;
+            continue;
+        }
+        if (base->second.at("exitCode") != metrics.at("exitCode"))
+        {
+            std::cout << program << " : FAIL exit code " << base->second.at("exitCode").value_or(0) << " -> " << metrics.at("exitCode").value_or(0) << std::endl;
+            passed = false;
+        }
+        for (const Metric &metric : s_Metrics)
+        {
+            const auto before = base->second.find(metric.name);
+            const auto after = metrics.find(metric.name);
+            if (before == base->second.end() || after == metrics.end() || !before->second.has_value() || !after->second.has_value())
+                continue;
+            const double was = static_cast<double>(before->second.value()), now = static_cast<double>(after->second.value());
+            const double change = was ? (now - was) / was * 100 : 0;
+            if (now > was * (1 + metric.tolerance))
+            {
+                std::cout << program << " : FAIL " << metric.name << " " << was << " -> " << now << " (+" << change << "%, tolerance " << metric.tolerance * 100 << "%)" << std::endl;
+                passed = false;
+            }
+            else if (now < was)
+                std::cout << program << " : " << metric.name << " " << was << " -> " << now << " (" << change << "%)" << std::endl;
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char const *argv[])
+{
+    bool update = false;
+    size_t runs = 5;
+    std::optional<std::string> baselinePath;
+    std::vector<std::filesystem::path> programs;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--update")
+            update = true;
+        else if (arg.starts_with("--runs="))
+            runs = std::max<size_t>(1, std::strtoull(arg.c_str() + std::string("--runs=").size(), nullptr, 10));
+        else if (!baselinePath.has_value())
+            baselinePath = arg;
+        else
+            programs.emplace_back(arg);
+    }
+    if (!baselinePath.has_value() || programs.empty())
+    {
+        std::cerr << "Error : Invalid Usage blue-perf [--update] [--runs=<n>] <baseline.json> <program.bl>..." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Results results;
+    for (const std::filesystem::path &program : programs)
+        results[program.stem().string()] = measure(program, runs);
+    writeResults("perf-results.json", results);
+    if (std::ranges::any_of(results, [](const auto &program)
+                            { return !program.second.at("cycles").has_value(); }))
+        std::cerr << "Warning : some hardware counters aren't available, only the static metrics are compared for them" << std::endl;
+
+    if (update)
+    {
+        writeResults(baselinePath.value(), results);
+        std::cout << "baseline written to " << baselinePath.value() << std::endl;
+        return EXIT_SUCCESS;
+    }
+    std::ifstream input(baselinePath.value());
+    if (!input.is_open())
+    {
+        std::cerr << "Error : No baseline at " << baselinePath.value() << ", record one with --update" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::stringstream buf;
+    buf << input.rdbuf();
+    return compare(ResultsReader(buf.str()).read(), results) ? EXIT_SUCCESS : EXIT_FAILURE;
+}